@@ -1,10 +1,14 @@
 #include <string.h>
 #include <algorithm>
+#include <new>
 #include "libchess.h"
 #include "MyAI.h"
 using namespace std;
 
+static const int pieceValues[FIN_COVER] = {1000, 1000, 500, 500, 400, 400, 300, 300, 200, 200, 200, 200, 100, 100};
+
 MyAI::MyAI() {
+	SetHashSize(16);
 	InitBoard();
 }
 
@@ -16,6 +20,7 @@ void MyAI::InitBoard() {
 	time[BLK] = 0;
 	memcpy(coverPieceCount, cover, sizeof(int) * 14);
 	allCoverCount = BOARD_SIZE;
+	tt.clear();
 	for (int i = 0, sq = 0; i < ROW_COUNT; i++) {
 		for (int j = 0; j < COL_COUNT; j++, sq++) {
 			board[sq] = FIN_COVER;
@@ -28,7 +33,7 @@ void MyAI::InitBoard(const char* data[]) {
 	color = UNKNOWN;
 	time[RED] = 0;
 	time[BLK] = 0;
-	allCoverCount = BOARD_SIZE;
+	allCoverCount = 0;
 	for (int r = ROW_COUNT - 1, i = 0; r >= 0; r--) {
 		for (int c = 0; c < COL_COUNT; c++, i++) {
 			board[r + c * 4] = char2fin(data[i][0]);
@@ -59,234 +64,527 @@ void MyAI::SetColor(COLOR c) {
 	color = c;
 }
 
+// Remaining clock in milliseconds
 void MyAI::SetTime(COLOR c, int t) {
 	time[c] = t;
 }
 
-// Generate the best move using alpha-beta pruning
-MOVE MyAI::GenerateMove() const {
-    Node rootNode = createNode(board, numeric_limits<int>::min(), numeric_limits<int>::max(), 0);
-    int bestScore = numeric_limits<int>::min();
-    MOVE bestMove = MOVE_NULL;
-    std::vector<MOVE> legalMoves = getAllMoves(board, (COLOR)color);
-    int tempCoverPieceCount[14];
-	int tempAllCoverCount;
-    memcpy(tempCoverPieceCount, coverPieceCount, sizeof(int) * 14);
-	tempAllCoverCount = allCoverCount;
-    for (MOVE move : legalMoves) {
-        FIN tempBoard[BOARD_SIZE];
-        memcpy(tempBoard, board, sizeof(FIN) * BOARD_SIZE);
-        int from = from_square(move);
-        int to = to_square(move);
-        if (from == to) { // Flip move
-            FIN flippedPiece = (FIN)(rand() % FIN_COVER);
-            if (tempCoverPieceCount[flippedPiece] == 0) { 
-                for (int f = 0; f < FIN_COVER; f++) {
-                    if (tempCoverPieceCount[f] > 0) {
-                        flippedPiece = (FIN)f;
-                        break;
-                    }
-                }
-                if(tempCoverPieceCount[flippedPiece] == 0) {
-                    continue;
-                }
-            }
-           applyFlip(tempBoard, to, flippedPiece, tempCoverPieceCount, tempAllCoverCount);
-             int score = alphaBeta(createNode(tempBoard, numeric_limits<int>::min(), numeric_limits<int>::max(), 1), maxDepth - 1 ,numeric_limits<int>::min(), numeric_limits<int>::max(), (COLOR) !color, tempCoverPieceCount, tempAllCoverCount);
-               if (score > bestScore) {
-                   bestScore = score;
-                   bestMove = move;
-               }
-            memcpy(tempCoverPieceCount, coverPieceCount, sizeof(int) * 14);
-			tempAllCoverCount = allCoverCount;
-        } else { // Normal Move
-                applyMove(tempBoard, from, to);
-                int score = alphaBeta(createNode(tempBoard, numeric_limits<int>::min(), numeric_limits<int>::max(), 1), maxDepth - 1, numeric_limits<int>::min(), numeric_limits<int>::max(), (COLOR) !color, tempCoverPieceCount, tempAllCoverCount);
-                  if (score > bestScore) {
-                      bestScore = score;
-                      bestMove = move;
-                 }
-             memcpy(tempCoverPieceCount, coverPieceCount, sizeof(int) * 14);
-			 tempAllCoverCount = allCoverCount;
-        }
+// Transposition table size in MB, from 1 to MAX_HASH_MB
+void MyAI::SetHashSize(int mb) {
+	tt.resize(std::min(std::max(mb, 1), MAX_HASH_MB));
+}
+
+// Number of search threads, the main thread included
+void MyAI::SetThreads(int n) {
+	threads = std::max(1, n);
+}
+
+// Generate the best move by iterative deepening within the time budget
+MOVE MyAI::GenerateMove() {
+    SearchThread st;
+    initThread(st);
+    tt.newSearch();
+    MOVELIST legalMoves;
+    MovePicker picker(st, (COLOR)color, MOVE_NULL);
+    for (MOVE move; (move = picker.next()) != MOVE_NULL; ) {
+        legalMoves.push(move);
     }
     printf("legal: ");
     for (int i = 0; i < legalMoves.size(); i++) {
         printf("%s, ", to_string(legalMoves[i]).c_str());
     }
     printf("\n");
+    if (legalMoves.empty()) {
+        return MOVE_NULL;
+    }
+    if (color == UNKNOWN || legalMoves.size() == 1) {
+        return legalMoves[0]; // Opening flip or forced move, nothing to search
+    }
+
+    startClock();
+    int depthLimit = hardLimit > 0 ? MAX_DEPTH : maxDepth;
+    std::vector<std::unique_ptr<SearchThread>> helpers;
+    std::vector<std::thread> workers;
+    for (int id = 1; id < threads; id++) {
+        helpers.emplace_back(new SearchThread);
+        initThread(*helpers.back());
+        workers.emplace_back(&MyAI::helperSearch, this, id, std::ref(*helpers.back()), legalMoves);
+    }
+    MOVE bestMove = legalMoves[0];
+    for (int depth = 1; depth <= depthLimit; depth++) {
+        int score;
+        MOVE move = searchRoot(st, depth, legalMoves, score);
+        if (stop) {
+            break; // Keep the move of the last completed depth
+        }
+        bestMove = move;
+        printf("depth %d score %d move %s nodes %lld time %d ms\n",
+               depth, score, to_string(move).c_str(), st.nodes, elapsed());
+        if (hardLimit > 0 && elapsed() * 2 > softLimit) {
+            break; // The next depth would not finish in time
+        }
+    }
+    stop = true;
+    long long nodes = st.nodes;
+    for (int i = 0; i < (int)workers.size(); i++) {
+        workers[i].join();
+        nodes += helpers[i]->nodes;
+    }
+    printf("threads %d nodes %lld time %d ms\n", threads, nodes, elapsed());
 	return bestMove;
 }
 
-// Get all legal moves
-std::vector<MOVE> MyAI::getAllMoves(const FIN board[BOARD_SIZE], COLOR player) const {
-    std::vector<MOVE> moveList;	
-    int to, cnt, row, col;
-    for (int i = 0; i < BOARD_SIZE; i++) {
-        if (board[i] == FIN_COVER) {
-            moveList.push_back(make_move(i, i)); // Flip move
-        } else if (board[i] != FIN_EMPTY && color_of(board[i]) == player) {
-            row = i % ROW_COUNT;
-            col = i / ROW_COUNT;
-            if (board[i] == FIN_C || board[i] == FIN_c) {
-                for (int delta : {-ROW_COUNT, +1, +ROW_COUNT, -1}) {
-                    to = i + delta;
-                    cnt = 0;
-                    while (to >= 0 && to < BOARD_SIZE && (to % ROW_COUNT == row || to / ROW_COUNT == col)) {
-                        cnt += (board[to] != FIN_EMPTY);
-                        if (cnt == 2 && color_of(board[to]) == !player) {
-                            moveList.push_back(make_move(i, to)); // Cannon capture
-                            break;
-                        }
-                        to += delta;
-                    }
-                }
-            }
-            for (int to : {i-ROW_COUNT, i+1, i+ROW_COUNT, i-1}) {
-                if (to >= 0 && to < BOARD_SIZE && (to % ROW_COUNT == row || to / ROW_COUNT == col)
-                && can_capture(board[i], board[to])) {
-                    moveList.push_back(make_move(i, to)); // Normal move
-                }
-            }
+// Lazy SMP helper: search the same root until stopped, sharing results with
+// the main thread only through the transposition table. Odd helpers start one
+// depth ahead and each helper rotates the root moves, so threads spread over
+// different parts of the tree
+void MyAI::helperSearch(int id, SearchThread &st, MOVELIST rootMoves) {
+    std::rotate(rootMoves.begin(), rootMoves.begin() + id % rootMoves.size(), rootMoves.end());
+    for (int depth = 1 + id % 2; depth <= MAX_DEPTH && !stop; depth++) {
+        int score;
+        searchRoot(st, depth, rootMoves, score);
+    }
+}
+
+// Search every root move to depth, the best one is moved to the front of rootMoves
+MOVE MyAI::searchRoot(SearchThread &st, int depth, MOVELIST &rootMoves, int &bestScore) {
+    bestScore = -INF;
+    int bestIndex = -1;
+    for (int i = 0; i < rootMoves.size(); i++) {
+        int score = searchMove(st, rootMoves[i], depth - 1, bestScore, INF, (COLOR)color);
+        if (stop) {
+            return MOVE_NULL;
         }
+        if (score > bestScore) {
+            bestScore = score;
+            bestIndex = i;
+        }
+    }
+    if (bestIndex < 0) {
+        return rootMoves[0];
+    }
+    std::rotate(rootMoves.begin(), rootMoves.begin() + bestIndex, rootMoves.begin() + bestIndex + 1);
+    return rootMoves[0];
+}
+
+// Start the clock for this move and split the remaining time into a budget
+// Many covered pieces means a long game ahead, so early moves get a smaller share
+void MyAI::startClock() {
+    startTime = std::chrono::steady_clock::now();
+    stop = false;
+    int remaining = time[color] - TIME_MARGIN;
+    if (time[color] <= 0) { // No clock given, search to maxDepth
+        softLimit = hardLimit = 0;
+        return;
+    }
+    int movesToGo = 10 + allCoverCount;
+    softLimit = std::max(1, remaining / movesToGo);
+    hardLimit = std::max(softLimit, std::min(softLimit * 4, remaining / 4));
+}
+
+// Milliseconds since startClock()
+int MyAI::elapsed() const {
+    return (int)std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - startTime).count();
+}
+
+// Poll the clock every 1024 nodes, raise stop once the hard limit is hit
+void MyAI::checkTime(const SearchThread &st) {
+    if (hardLimit > 0 && (st.nodes & 1023) == 0 && elapsed() >= hardLimit) {
+        stop = true;
     }
-    return moveList;
 }
 
 // Evaluation function
-int MyAI::evaluateBoard(const FIN board[BOARD_SIZE], COLOR player) const{
+int MyAI::evaluateBoard(const POSITION &pos, COLOR player) const {
     int score = 0;
-    int pieceValues[] = {1000, 1000, 500, 500, 400, 400, 300, 300, 200, 200, 200, 200, 100, 100};
-    for (int i = 0; i < BOARD_SIZE; i++) {
-        if (board[i] != FIN_COVER && board[i] != FIN_EMPTY) {
-            int pieceValue = pieceValues[board[i]];
-            if(color_of(board[i]) == player) {
-                score += pieceValue;
-            } else {
-                score -= pieceValue;
-            }
+    for (int f = 0; f < FIN_COVER; f++) {
+        int pieceValue = pieceValues[f] * popcount(pos.pieces[f]);
+        if (color_of(FIN(f)) == player) {
+            score += pieceValue;
+        } else {
+            score -= pieceValue;
         }
     }
     return score;
 }
 
-// Alpha-beta pruning function
-int MyAI::alphaBeta(Node node, int depth, int alpha, int beta, COLOR player, int coverPieceCount[14], int allCoverCount) const {
-     if (depth == 0) {
-       return evaluateBoard(node.board, (COLOR)color);
-    }
-    std::vector<MOVE> legalMoves = getAllMoves(node.board, player);
-     if (legalMoves.empty()) {
-           return evaluateBoard(node.board, (COLOR)color);
-     }
-     if (player == (COLOR)color) { // Maximizing player
-        int maxEval = numeric_limits<int>::min();
-        for (MOVE move : legalMoves) {
-            FIN tempBoard[BOARD_SIZE];
-            int tempCoverPieceCount[14];
-			int tempAllCoverCount;
-             memcpy(tempCoverPieceCount, coverPieceCount, sizeof(int) * 14);
-			 tempAllCoverCount = allCoverCount;
-            memcpy(tempBoard, node.board, sizeof(FIN) * BOARD_SIZE);
-            int from = from_square(move);
-            int to = to_square(move);
-            if(from == to) {
-                FIN flippedPiece = (FIN)(rand() % FIN_COVER);
-                    if (tempCoverPieceCount[flippedPiece] == 0) {
-                    for (int f = 0; f < FIN_COVER; f++) {
-                        if (tempCoverPieceCount[f] > 0) {
-                            flippedPiece = (FIN)f;
-                            break;
-                        }
-                    }
-                    if(tempCoverPieceCount[flippedPiece] == 0) {
-                        continue;
-                    }
-                }
-                applyFlip(tempBoard, to, flippedPiece, tempCoverPieceCount, tempAllCoverCount);
-                  int eval = alphaBeta(createNode(tempBoard, alpha, beta, depth - 1), depth - 1, alpha, beta, (COLOR) !player, tempCoverPieceCount, tempAllCoverCount);
-               maxEval = std::max(maxEval, eval);
-               alpha = std::max(alpha, eval);
-               if (beta <= alpha) {
-                    break;
-                 }
-            } else {
-                  applyMove(tempBoard, from, to);
-                  int eval = alphaBeta(createNode(tempBoard, alpha, beta, depth - 1), depth - 1, alpha, beta, (COLOR) !player, tempCoverPieceCount, tempAllCoverCount);
-                  maxEval = std::max(maxEval, eval);
-                   alpha = std::max(alpha, eval);
-               if (beta <= alpha) {
-                  break;
-                 }
+// Alpha-beta pruning function, scores are from the point of view of player
+int MyAI::alphaBeta(SearchThread &st, int depth, int alpha, int beta, COLOR player) {
+    checkTime(st);
+    if (stop) {
+        return 0;
+    }
+    if (depth == 0) {
+        return quiescence(st, alpha, beta, player);
+    }
+    TTData ttData;
+    MOVE ttMove = MOVE_NULL;
+    if (tt.probe(st.pos.key, ttData)) {
+        ttMove = ttData.move;
+        if (ttData.depth >= depth
+         && (ttData.bound == BOUND_EXACT
+          || (ttData.bound == BOUND_LOWER && ttData.score >= beta)
+          || (ttData.bound == BOUND_UPPER && ttData.score <= alpha))) {
+            return ttData.score;
+        }
+    }
+    int alphaOrig = alpha;
+    int bestEval = -INF;
+    MOVE bestMove = MOVE_NULL;
+    MovePicker picker(st, player, ttMove);
+    for (MOVE move; (move = picker.next()) != MOVE_NULL; ) {
+        int eval = searchMove(st, move, depth - 1, alpha, beta, player);
+        if (stop) {
+            return 0;
+        }
+        if (eval > bestEval) {
+            bestEval = eval;
+            bestMove = move;
+        }
+        alpha = std::max(alpha, eval);
+        if (beta <= alpha) {
+            if (!is_capture(st.pos, move)) {
+                updateQuietStats(st, move, depth);
             }
+            break;
         }
-        return maxEval;
-    } else { // Minimizing player
-        int minEval = numeric_limits<int>::max();
-           for (MOVE move : legalMoves) {
-            FIN tempBoard[BOARD_SIZE];
-			int tempCoverPieceCount[14];
-			int tempAllCoverCount;
-             memcpy(tempCoverPieceCount, coverPieceCount, sizeof(int) * 14);
-			 tempAllCoverCount = allCoverCount;
-            memcpy(tempBoard, node.board, sizeof(FIN) * BOARD_SIZE);
-            int from = from_square(move);
-            int to = to_square(move);
-            if(from == to) {
-                 FIN flippedPiece = (FIN)(rand() % FIN_COVER);
-                    if (tempCoverPieceCount[flippedPiece] == 0) {
-                    for (int f = 0; f < FIN_COVER; f++) {
-                        if (tempCoverPieceCount[f] > 0) {
-                            flippedPiece = (FIN)f;
-                            break;
-                        }
-                    }
-                    if(tempCoverPieceCount[flippedPiece] == 0) {
-                        continue;
-                    }
-                }
-               applyFlip(tempBoard, to, flippedPiece, tempCoverPieceCount, tempAllCoverCount);
-                int eval = alphaBeta(createNode(tempBoard, alpha, beta, depth - 1), depth - 1, alpha, beta, (COLOR) !player, tempCoverPieceCount, tempAllCoverCount);
-                 minEval = std::min(minEval, eval);
-                beta = std::min(beta, eval);
-                if (beta <= alpha) {
-                    break;
-                }
-            } else {
-                  applyMove(tempBoard, from, to);
-                   int eval = alphaBeta(createNode(tempBoard, alpha, beta, depth - 1), depth - 1, alpha, beta, (COLOR) !player, tempCoverPieceCount, tempAllCoverCount);
-                 minEval = std::min(minEval, eval);
-                   beta = std::min(beta, eval);
-                if (beta <= alpha) {
-                    break;
+    }
+    if (bestEval == -INF) { // No move searched
+        return evaluateBoard(st.pos, player);
+    }
+    tt.store(st.pos.key, bestEval, bestMove, depth,
+             bestEval >= beta ? BOUND_LOWER : bestEval <= alphaOrig ? BOUND_UPPER : BOUND_EXACT);
+    return bestEval;
+}
+
+// Set up a search thread on the current position
+void MyAI::initThread(SearchThread &st) const {
+    set_position(st.pos, board, coverPieceCount, (COLOR)color);
+    st.ply = 0;
+    st.nodes = 0;
+    for (int i = 0; i < MAX_PLY; i++) {
+        st.killers[i][0] = st.killers[i][1] = MOVE_NULL;
+    }
+    memset(st.history, 0, sizeof(st.history));
+}
+
+// A quiet move or flip caused a cutoff: make it a killer and raise its history
+void MyAI::updateQuietStats(SearchThread &st, MOVE move, int depth) const {
+    MOVE *killers = st.killers[st.ply];
+    if (killers[0] != move) {
+        killers[1] = killers[0];
+        killers[0] = move;
+    }
+    st.history[from_square(move)][to_square(move)] += depth * depth;
+}
+
+// Play a move on the thread position, f is the revealed piece of a flip
+void MyAI::makeMove(SearchThread &st, MOVE move, FIN f) const {
+    do_move(st.pos, move, f, st.undo[st.ply++]);
+    st.nodes++;
+}
+
+// Take back the last move played on the thread position
+void MyAI::unmakeMove(SearchThread &st) const {
+    undo_move(st.pos, st.undo[--st.ply]);
+}
+
+// Quiescence search at the horizon: only captures, cannon jumps included, are
+// searched until the position is quiet. The side to move may stand pat on the
+// static evaluation instead of capturing
+int MyAI::quiescence(SearchThread &st, int alpha, int beta, COLOR player) {
+    checkTime(st);
+    if (stop) {
+        return 0;
+    }
+    int standPat = evaluateBoard(st.pos, player);
+    if (standPat >= beta || st.ply >= MAX_PLY - 1) {
+        return standPat;
+    }
+    alpha = std::max(alpha, standPat);
+    int bestEval = standPat;
+    MovePicker picker(st, player, MOVE_NULL, true);
+    for (MOVE move; (move = picker.next()) != MOVE_NULL; ) {
+        // Delta pruning: even winning the victim for free cannot raise alpha
+        if (standPat + pieceValues[st.pos.board[to_square(move)]] + DELTA_MARGIN <= alpha) {
+            continue;
+        }
+        makeMove(st, move, FIN_EMPTY);
+        int eval = -quiescence(st, -beta, -alpha, (COLOR) !player);
+        unmakeMove(st);
+        if (stop) {
+            return 0;
+        }
+        bestEval = std::max(bestEval, eval);
+        alpha = std::max(alpha, eval);
+        if (beta <= alpha) {
+            break;
+        }
+    }
+    return bestEval;
+}
+
+// Value of a move for player, with depth plies left after it
+int MyAI::searchMove(SearchThread &st, MOVE move, int depth, int alpha, int beta, COLOR player) {
+    if (from_square(move) == to_square(move)) {
+        // Every outcome of a flip multiplies the tree, so a flip costs extra depth
+        return chanceNode(st, move, std::max(depth - FLIP_REDUCTION, 0), alpha, beta, player);
+    }
+    makeMove(st, move, FIN_EMPTY);
+    int eval = -alphaBeta(st, depth, -beta, -alpha, (COLOR) !player);
+    unmakeMove(st);
+    return eval;
+}
+
+static long long divFloor(long long a, long long b) {
+    return a / b - (a % b != 0 && a < 0);
+}
+
+static long long divCeil(long long a, long long b) {
+    return -divFloor(-a, b);
+}
+
+// Expected value of a flip for player, weighted by the hidden pieces left.
+// Star2 first probes one reply per outcome for an upper bound on it, then
+// Star1 searches the outcomes with windows derived from the bounds of the
+// others, so the node can fail high or low before every outcome is searched.
+// Sums are kept multiplied by the number of hidden pieces to stay in integers.
+int MyAI::chanceNode(SearchThread &st, MOVE move, int depth, int alpha, int beta, COLOR player) {
+    FIN outcomes[FIN_COVER];
+    int weights[FIN_COVER], upper[FIN_COVER], k = 0;
+    for (int f = 0; f < FIN_COVER; f++) {
+        if (st.pos.coverPieceCount[f] > 0) {
+            outcomes[k] = (FIN)f;
+            weights[k] = st.pos.coverPieceCount[f];
+            upper[k++] = MAX_EVAL;
+        }
+    }
+    long long total = st.pos.allCoverCount;
+    if (k == 0) { // Inconsistent cover counts, nothing to reveal
+        return evaluateBoard(st.pos, player);
+    }
+    long long A = alpha * total, B = beta * total;
+
+    if (depth > 0) { // Star2 probing
+        long long upperSum = MAX_EVAL * total;
+        for (int i = 0; i < k; i++) {
+            upperSum -= (long long)weights[i] * MAX_EVAL;
+            // The whole node fails low once outcome i is worth at most t
+            long long t = divFloor(A - upperSum, weights[i]);
+            if (t >= -MAX_EVAL) {
+                makeMove(st, move, outcomes[i]);
+                upper[i] = std::min(MAX_EVAL, -probeReply(st, depth, (int)-t, (COLOR) !player));
+                unmakeMove(st);
+                if (stop) {
+                    return 0;
                 }
             }
+            upperSum += (long long)weights[i] * upper[i];
         }
-        return minEval;
+        if (upperSum <= A) {
+            return (int)divCeil(upperSum, total);
+        }
+    }
+
+    long long sum = 0, upperRest = 0, lowerRest = -MAX_EVAL * total;
+    for (int i = 0; i < k; i++) {
+        upperRest += (long long)weights[i] * upper[i];
+    }
+    for (int i = 0; i < k; i++) { // Star1
+        upperRest -= (long long)weights[i] * upper[i];
+        lowerRest += (long long)weights[i] * MAX_EVAL;
+        int a = (int)std::max<long long>(divFloor(A - sum - upperRest, weights[i]), -MAX_EVAL - 1);
+        int b = (int)std::min<long long>(divCeil(B - sum - lowerRest, weights[i]), MAX_EVAL + 1);
+        makeMove(st, move, outcomes[i]);
+        int eval = -alphaBeta(st, depth, -b, -a, (COLOR) !player);
+        unmakeMove(st);
+        if (stop) {
+            return 0;
+        }
+        if (eval >= b) {
+            return (int)divFloor(sum + (long long)weights[i] * eval + lowerRest, total);
+        }
+        if (eval <= a) {
+            return (int)divCeil(sum + (long long)weights[i] * eval + upperRest, total);
+        }
+        sum += (long long)weights[i] * eval;
     }
+    return (int)divFloor(sum, total);
 }
 
-// Create a new node
-Node MyAI::createNode(const FIN board[BOARD_SIZE], int alpha, int beta, int depth) const {
-    Node newNode;
-    memcpy(newNode.board, board, sizeof(FIN) * BOARD_SIZE);
-    newNode.alpha = alpha;
-    newNode.beta = beta;
-    newNode.depth = depth;
-    return newNode;
+// Search one reply of player, the first move of the move picker, with a
+// null window at threshold. Returns a lower bound on the position value, -INF if
+// the probe did not reach the threshold
+int MyAI::probeReply(SearchThread &st, int depth, int threshold, COLOR player) {
+    TTData ttData;
+    MovePicker picker(st, player, tt.probe(st.pos.key, ttData) ? ttData.move : MOVE_NULL);
+    MOVE probe = picker.next();
+    if (probe == MOVE_NULL) {
+        return -INF;
+    }
+    int eval = searchMove(st, probe, depth - 1, threshold - 1, threshold, player);
+    return eval >= threshold ? eval : -INF;
 }
 
-// Apply a move to a board
-void MyAI::applyMove(FIN board[BOARD_SIZE], int from, int to) const {
-    board[to] = board[from];
-    board[from] = FIN_EMPTY;
+MovePicker::MovePicker(const SearchThread &st, COLOR player, MOVE ttMove, bool capturesOnly) :
+    st(st), player(player), ttMove(ttMove), stage(STAGE_HASH), index(0), capturesOnly(capturesOnly) {
 }
 
-// Apply a flip to a board
-void MyAI::applyFlip(FIN board[BOARD_SIZE], int sq, FIN f, int coverPieceCount[14], int allCoverCount) const {
-	board[sq] = f;
-	coverPieceCount[f]--;
-	allCoverCount--;
+// Next move in stage order, MOVE_NULL when all moves are done
+MOVE MovePicker::next() {
+    const MOVE *killers = st.killers[st.ply];
+    switch (stage) {
+    case STAGE_HASH:
+        stage = STAGE_CAPTURES_INIT;
+        if (is_legal(st.pos, player, ttMove)) {
+            return ttMove;
+        }
+        // fall through
+    case STAGE_CAPTURES_INIT:
+        generate_captures(st.pos, player, moves);
+        for (SCORED_MOVE &m : moves) { // MVV-LVA
+            m.score = 10 * pieceValues[st.pos.board[to_square(m)]] - pieceValues[st.pos.board[from_square(m)]];
+        }
+        stage = STAGE_CAPTURES;
+        // fall through
+    case STAGE_CAPTURES:
+        while (index < moves.size()) {
+            MOVE move = pickBest();
+            if (move != ttMove) {
+                return move;
+            }
+        }
+        if (capturesOnly) {
+            stage = STAGE_DONE;
+            return MOVE_NULL;
+        }
+        stage = STAGE_KILLERS;
+        index = 0;
+        // fall through
+    case STAGE_KILLERS:
+        while (index < 2) {
+            MOVE move = killers[index++];
+            if (move != ttMove && !is_capture(st.pos, move) && is_legal(st.pos, player, move)) {
+                return move;
+            }
+        }
+        stage = STAGE_QUIETS_INIT;
+        // fall through
+    case STAGE_QUIETS_INIT:
+        moves.clear();
+        generate_quiets(st.pos, player, moves);
+        for (SCORED_MOVE &m : moves) {
+            m.score = st.history[from_square(m)][to_square(m)];
+        }
+        index = 0;
+        stage = STAGE_QUIETS;
+        // fall through
+    case STAGE_QUIETS:
+        while (index < moves.size()) {
+            MOVE move = pickBest();
+            if (move != ttMove && move != killers[0] && move != killers[1]) {
+                return move;
+            }
+        }
+        stage = STAGE_DONE;
+        // fall through
+    default:
+        return MOVE_NULL;
+    }
+}
+
+// Selection step: swap the best scored remaining move to index and take it
+MOVE MovePicker::pickBest() {
+    int best = index;
+    for (int i = index + 1; i < moves.size(); i++) {
+        if (moves.moves[i].score > moves.moves[best].score) {
+            best = i;
+        }
+    }
+    std::swap(moves.moves[index], moves.moves[best]);
+    return moves[index++];
+}
+
+// Resize the table to the largest power of two buckets that fits in mb
+void TranspositionTable::resize(size_t mb) {
+    size_t count = 1;
+    while (count * 2 * sizeof(Bucket) <= (mb << 20)) {
+        count *= 2;
+    }
+    // Free the old table first, and settle for a smaller one when memory is short
+    buckets.reset();
+    for (;;) {
+        buckets.reset(new (std::nothrow) Bucket[count]);
+        if (buckets || count == 1) {
+            break;
+        }
+        count /= 2;
+    }
+    if (!buckets) {
+        throw std::bad_alloc();
+    }
+    mask = count - 1;
+    clear();
+}
+
+void TranspositionTable::clear() {
+    for (size_t i = 0; i <= mask; i++) {
+        for (Entry &e : buckets[i].entries) {
+            e.key.store(0, std::memory_order_relaxed);
+            e.data.store(0, std::memory_order_relaxed);
+        }
+    }
+    generation = 0;
+}
+
+// Age the stored entries, they become the first to be replaced
+void TranspositionTable::newSearch() {
+    generation = (generation + 1) & 0x3F;
+}
+
+// Entries are written without locks, so an entry only counts when its key,
+// stored XORed with its data, decodes back to the probed key
+bool TranspositionTable::probe(uint64_t key, TTData &data) const {
+    const Bucket &bucket = buckets[key & mask];
+    for (const Entry &e : bucket.entries) {
+        uint64_t d = e.data.load(std::memory_order_relaxed);
+        if (d != 0 && (e.key.load(std::memory_order_relaxed) ^ d) == key) {
+            data.score = (int32_t)(uint32_t)d;
+            data.move = (MOVE)((d >> 32) & 0xFFFF);
+            data.depth = (d >> 48) & 0xFF;
+            data.bound = (BOUND)((d >> 56) & 0x3);
+            return true;
+        }
+    }
+    return false;
+}
+
+// Replace the entry of the same position, otherwise the shallowest of the oldest
+void TranspositionTable::store(uint64_t key, int score, MOVE move, int depth, BOUND bound) {
+    Bucket &bucket = buckets[key & mask];
+    Entry *replace = &bucket.entries[0];
+    int worst = std::numeric_limits<int>::max();
+    for (Entry &e : bucket.entries) {
+        uint64_t d = e.data.load(std::memory_order_relaxed);
+        if (d == 0 || (e.key.load(std::memory_order_relaxed) ^ d) == key) {
+            replace = &e;
+            break;
+        }
+        int age = (generation - (int)(d >> 58)) & 0x3F;
+        int value = (int)((d >> 48) & 0xFF) - 8 * age;
+        if (value < worst) {
+            worst = value;
+            replace = &e;
+        }
+    }
+    uint64_t d = (uint64_t)(uint32_t)score
+               | (uint64_t)(move & 0xFFFF) << 32
+               | (uint64_t)depth << 48
+               | (uint64_t)bound << 56
+               | (uint64_t)generation << 58;
+    replace->key.store(key ^ d, std::memory_order_relaxed);
+    replace->data.store(d, std::memory_order_relaxed);
 }
 
 string MyAI::GetProtocolVersion() const {
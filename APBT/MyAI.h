@@ -6,12 +6,105 @@
 #include <string>
 #include <math.h>
 #include <time.h>
-#include <vector>
 #include <limits>
+#include <vector>
+#include <chrono>
+#include <atomic>
+#include <memory>
+#include <thread>
 
 #include "libchess.h"
 
-struct Node;
+static const int MAX_PLY = 128;
+static const int MAX_DEPTH = 64;
+static const int INF = 1000000; // Bound on every search score
+static const int MAX_EVAL = 10000; // Bound on every evaluateBoard() score
+static const int FLIP_REDUCTION = 1; // Extra plies a flip costs
+static const int DELTA_MARGIN = 100; // Quiescence delta pruning margin
+static const int TIME_MARGIN = 100; // ms kept back for protocol overhead
+static const int MAX_HASH_MB = 4096; // Largest transposition table
+
+// Mutable search state, one per search thread
+struct SearchThread {
+    POSITION pos;
+    UNDO undo[MAX_PLY];
+    int ply;
+    long long nodes;
+    MOVE killers[MAX_PLY][2];             // Quiet moves that caused a cutoff, per ply
+    int history[BOARD_SIZE][BOARD_SIZE];  // Cutoff statistics of quiet moves, by from and to
+};
+
+// Staged move picker: hash move, captures by MVV-LVA, killer moves, then quiet
+// moves and flips by history. Each stage is generated only when it is reached.
+// With capturesOnly the picker stops after the captures, for quiescence search
+class MovePicker {
+public:
+    MovePicker(const SearchThread &st, COLOR player, MOVE ttMove, bool capturesOnly = false);
+    MOVE next();
+
+private:
+    enum Stage {
+        STAGE_HASH,
+        STAGE_CAPTURES_INIT,
+        STAGE_CAPTURES,
+        STAGE_KILLERS,
+        STAGE_QUIETS_INIT,
+        STAGE_QUIETS,
+        STAGE_DONE,
+    };
+
+    MOVE pickBest();
+
+    const SearchThread &st;
+    COLOR player;
+    MOVE ttMove;
+    int stage;
+    int index;
+    bool capturesOnly;
+    MOVELIST moves;
+};
+
+// Bound type of a stored score
+enum BOUND : int {
+    BOUND_NONE,
+    BOUND_UPPER,
+    BOUND_LOWER,
+    BOUND_EXACT,
+};
+
+// What a transposition table probe returns
+struct TTData {
+    int score;
+    MOVE move;
+    int depth;
+    BOUND bound;
+};
+
+// Transposition table of 4-entry buckets, one cache line each, shared by all
+// search threads without locks
+class TranspositionTable {
+public:
+    void resize(size_t mb);
+    void clear();
+    void newSearch();
+    bool probe(uint64_t key, TTData &data) const;
+    void store(uint64_t key, int score, MOVE move, int depth, BOUND bound);
+
+private:
+    // data packs score (32 bits), move (16), depth (8), bound (2) and generation (6),
+    // key holds the position key XORed with data
+    struct Entry {
+        std::atomic<uint64_t> key;
+        std::atomic<uint64_t> data;
+    };
+    struct alignas(64) Bucket {
+        Entry entries[4];
+    };
+
+    std::unique_ptr<Bucket[]> buckets;
+    size_t mask = 0;
+    uint8_t generation = 0;
+};
 
 class MyAI {
 public:
@@ -23,14 +116,25 @@ public:
     void Flip(int sq, FIN f);
     void SetColor(COLOR c);
     void SetTime(COLOR c, int t);
-    MOVE GenerateMove() const;
+    void SetHashSize(int mb);
+    void SetThreads(int n);
+    MOVE GenerateMove();
 
-    std::vector<MOVE> getAllMoves(const FIN board[BOARD_SIZE], COLOR player) const;
-    int evaluateBoard(const FIN board[BOARD_SIZE], COLOR player) const;
-    int alphaBeta(Node node, int depth, int alpha, int beta, COLOR player, int coverPieceCount[14], int allCoverCount) const;
-    Node createNode(const FIN board[BOARD_SIZE], int alpha, int beta, int depth) const;
-    void applyMove(FIN board[BOARD_SIZE], int from, int to) const;
-    void applyFlip(FIN board[BOARD_SIZE], int sq, FIN f, int coverPieceCount[14], int allCoverCount) const;
+    int evaluateBoard(const POSITION &pos, COLOR player) const;
+    MOVE searchRoot(SearchThread &st, int depth, MOVELIST &rootMoves, int &bestScore);
+    void helperSearch(int id, SearchThread &st, MOVELIST rootMoves);
+    int alphaBeta(SearchThread &st, int depth, int alpha, int beta, COLOR player);
+    int quiescence(SearchThread &st, int alpha, int beta, COLOR player);
+    int searchMove(SearchThread &st, MOVE move, int depth, int alpha, int beta, COLOR player);
+    int chanceNode(SearchThread &st, MOVE move, int depth, int alpha, int beta, COLOR player);
+    int probeReply(SearchThread &st, int depth, int threshold, COLOR player);
+    void initThread(SearchThread &st) const;
+    void updateQuietStats(SearchThread &st, MOVE move, int depth) const;
+    void makeMove(SearchThread &st, MOVE move, FIN f) const;
+    void unmakeMove(SearchThread &st) const;
+    void startClock();
+    int elapsed() const;
+    void checkTime(const SearchThread &st);
 
     std::string GetProtocolVersion() const;
     std::string GetAIName() const;
@@ -44,14 +148,14 @@ private:
     int coverPieceCount[14];
     int allCoverCount;
 
-    int maxDepth = 5; // Max search depth
-};
+    int maxDepth = 5; // Max search depth when no clock is given
+    TranspositionTable tt;
+    int threads = 1;
 
-struct Node {
-    FIN board[BOARD_SIZE];
-    int alpha;
-    int beta;
-    int depth;
+    std::chrono::steady_clock::time_point startTime;
+    int softLimit; // ms, no new depth is started past half of it
+    int hardLimit; // ms, the search stops mid-depth here
+    std::atomic<bool> stop;
 };
 
 #endif
\ No newline at end of file
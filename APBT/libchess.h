@@ -2,6 +2,7 @@
 #define LIBCHESS_H
 
 #include "string"
+#include <stdint.h>
 
 static const int BOARD_SIZE = 32;
 static const int ROW_COUNT = 8;
@@ -44,7 +45,7 @@ enum FIN : int {
 	FIN_COUNT = 16,
 };
 
-inline COLOR color_of(FIN f) {
+constexpr COLOR color_of(FIN f) {
 	if (f == FIN_COVER || f == FIN_EMPTY) {
 		return UNKNOWN;
 	}
@@ -89,44 +90,430 @@ inline FIN char2fin(char c) {
 	return FIN_COUNT;
 }
 
-inline FIN type_of(FIN f) {
+constexpr FIN type_of(FIN f) {
 	return FIN(f & 0xE);
 }
 
+/// Capture rule between piece types, attacker (row) against victim (column)
+///                                  K  G  M  R  N  C  P
+static constexpr bool TYPE_CAPTURE[7][7] = {
+	{1, 1, 1, 1, 1, 1, 0}, /// K
+	{0, 1, 1, 1, 1, 1, 1}, /// G
+	{0, 0, 1, 1, 1, 1, 1}, /// M
+	{0, 0, 0, 1, 1, 1, 1}, /// R
+	{0, 0, 0, 0, 1, 1, 1}, /// N
+	{0, 0, 0, 0, 0, 0, 0}, /// C, only captures by jumping
+	{1, 0, 0, 0, 0, 0, 1}, /// P
+};
+
+/// Adjacent move rule for every attacker and victim, covered and empty squares included
+struct CAPTURE_TABLE {
+	bool rule[FIN_COUNT][FIN_COUNT];
+};
+
+constexpr CAPTURE_TABLE make_capture_table() {
+	CAPTURE_TABLE t{};
+	for (int a = 0; a < FIN_COVER; a++) {
+		t.rule[a][FIN_EMPTY] = true;
+		for (int v = 0; v < FIN_COVER; v++) {
+			t.rule[a][v] = color_of(FIN(a)) != color_of(FIN(v))
+			            && TYPE_CAPTURE[type_of(FIN(a)) / 2][type_of(FIN(v)) / 2];
+		}
+	}
+	return t;
+}
+
+static constexpr CAPTURE_TABLE CAPTURE = make_capture_table();
+
 inline bool can_capture(FIN attacker, FIN victim) {
-	if (attacker == FIN_COVER || attacker == FIN_EMPTY || victim == FIN_COVER) {
-		return false;
+	return CAPTURE.rule[attacker][victim];
+}
+
+/// Bitboard, bit i stands for square i (file-major like the board array)
+typedef uint32_t BITBOARD;
+
+static const BITBOARD BB_RANK1 = 0x01010101;
+
+constexpr BITBOARD square_bb(int sq) {
+	return BITBOARD(1) << sq;
+}
+
+inline int popcount(BITBOARD b) {
+	return __builtin_popcount(b);
+}
+
+inline int pop_lsb(BITBOARD &b) {
+	int sq = __builtin_ctz(b);
+	b &= b - 1;
+	return sq;
+}
+
+/// Ray directions, in the order files and ranks are scanned
+enum DIRECTION : int {
+	WEST,  /// toward file a
+	NORTH, /// toward rank 8
+	EAST,  /// toward file d
+	SOUTH, /// toward rank 1
+
+	DIRECTION_COUNT,
+};
+
+/// Neighbors and rays of every square, nearest square first
+struct SQUARE_TABLE {
+	int neighborCount[BOARD_SIZE];
+	int neighbors[BOARD_SIZE][DIRECTION_COUNT];
+	BITBOARD neighborBB[BOARD_SIZE];
+	int rayLength[BOARD_SIZE][DIRECTION_COUNT];
+	int rays[BOARD_SIZE][DIRECTION_COUNT][ROW_COUNT - 1];
+};
+
+constexpr SQUARE_TABLE make_square_table() {
+	constexpr int dr[DIRECTION_COUNT] = {0, 1, 0, -1};
+	constexpr int dc[DIRECTION_COUNT] = {-1, 0, 1, 0};
+	SQUARE_TABLE t{};
+	for (int sq = 0; sq < BOARD_SIZE; sq++) {
+		for (int d = 0; d < DIRECTION_COUNT; d++) {
+			for (int r = sq % ROW_COUNT + dr[d], c = sq / ROW_COUNT + dc[d];
+			     r >= 0 && r < ROW_COUNT && c >= 0 && c < COL_COUNT; r += dr[d], c += dc[d]) {
+				int to = c * ROW_COUNT + r;
+				if (t.rayLength[sq][d] == 0) {
+					t.neighbors[sq][t.neighborCount[sq]++] = to;
+					t.neighborBB[sq] |= square_bb(to);
+				}
+				t.rays[sq][d][t.rayLength[sq][d]++] = to;
+			}
+		}
 	}
+	return t;
+}
 
-	if (victim == FIN_EMPTY) {
-		return true;
+static constexpr SQUARE_TABLE SQUARES = make_square_table();
+
+constexpr uint64_t splitmix64(uint64_t &state) {
+	uint64_t z = (state += 0x9E3779B97F4A7C15ULL);
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+	return z ^ (z >> 31);
+}
+
+/// Zobrist keys: piece or cover on a square, hidden pieces left of each kind, side to move
+/// Empty squares have no key
+struct ZOBRIST_TABLE {
+	uint64_t piece[FIN_COUNT][BOARD_SIZE];
+	uint64_t hidden[FIN_COVER][6]; /// at most 5 of a kind
+	uint64_t side;
+};
+
+constexpr ZOBRIST_TABLE make_zobrist_table() {
+	ZOBRIST_TABLE t{};
+	uint64_t state = 0x2545F4914F6CDD1DULL;
+	for (int f = 0; f <= FIN_COVER; f++) {
+		for (int sq = 0; sq < BOARD_SIZE; sq++) {
+			t.piece[f][sq] = splitmix64(state);
+		}
+	}
+	for (int f = 0; f < FIN_COVER; f++) {
+		for (int n = 0; n < 6; n++) {
+			t.hidden[f][n] = splitmix64(state);
+		}
 	}
+	t.side = splitmix64(state);
+	return t;
+}
 
-	if (color_of(attacker) == color_of(victim)) {
-		return false;
+static constexpr ZOBRIST_TABLE ZOBRIST = make_zobrist_table();
+
+/// Bitboard position
+/// board[] is kept alongside the bitboards so piece lookup stays O(1)
+struct POSITION {
+	FIN board[BOARD_SIZE];
+	BITBOARD pieces[FIN_COVER]; /// one per piece type and color
+	BITBOARD colors[2];         /// all revealed pieces of a color
+	BITBOARD covered;
+	BITBOARD empty;
+	int coverPieceCount[FIN_COVER]; /// hidden pieces left of each kind
+	int allCoverCount;
+	uint64_t key;                   /// Zobrist key, updated incrementally
+};
+
+inline void put_piece(POSITION &pos, int sq, FIN f) {
+	BITBOARD b = square_bb(sq);
+	pos.board[sq] = f;
+	pos.key ^= ZOBRIST.piece[f][sq];
+	if (f == FIN_COVER) {
+		pos.covered |= b;
+	} else if (f == FIN_EMPTY) {
+		pos.empty |= b;
+	} else {
+		pos.pieces[f] |= b;
+		pos.colors[color_of(f)] |= b;
 	}
+}
 
-	attacker = type_of(attacker);
-	victim = type_of(victim);
-
-	switch (attacker) {
-	case FIN_K:
-		return victim != FIN_P;
-	case FIN_G:
-		return victim != FIN_K;
-	case FIN_M:
-		return victim != FIN_K && victim != FIN_G;
-	case FIN_R:
-		return victim != FIN_K && victim != FIN_G && victim != FIN_M;
-	case FIN_N:
-		return victim == FIN_N || victim == FIN_C || victim == FIN_P;
-	case FIN_C:
+inline void remove_piece(POSITION &pos, int sq) {
+	BITBOARD b = ~square_bb(sq);
+	FIN f = pos.board[sq];
+	pos.key ^= ZOBRIST.piece[f][sq];
+	if (f == FIN_COVER) {
+		pos.covered &= b;
+	} else if (f == FIN_EMPTY) {
+		pos.empty &= b;
+	} else {
+		pos.pieces[f] &= b;
+		pos.colors[color_of(f)] &= b;
+	}
+}
+
+/// Cover counts are left at zero when not given, move generation does not need them
+/// The side to move only matters for the key, do_move() flips it on every move
+inline void set_position(POSITION &pos, const FIN board[BOARD_SIZE], const int coverPieceCount[FIN_COVER] = nullptr,
+                         COLOR side = RED) {
+	pos.allCoverCount = 0;
+	pos.key = side == BLK ? ZOBRIST.side : 0;
+	for (int f = 0; f < FIN_COVER; f++) {
+		pos.pieces[f] = 0;
+		pos.coverPieceCount[f] = coverPieceCount ? coverPieceCount[f] : 0;
+		pos.allCoverCount += pos.coverPieceCount[f];
+		pos.key ^= ZOBRIST.hidden[f][pos.coverPieceCount[f]];
+	}
+	pos.colors[RED] = pos.colors[BLK] = 0;
+	pos.covered = pos.empty = 0;
+	for (int sq = 0; sq < BOARD_SIZE; sq++) {
+		put_piece(pos, sq, board[sq]);
+	}
+}
+
+/// Everything needed to take a move back
+struct UNDO {
+	MOVE move;
+	FIN captured; /// previous content of the destination square, FIN_COVER for a flip
+};
+
+/// Play a move on the position, f is the revealed piece when the move is a flip
+inline void do_move(POSITION &pos, MOVE m, FIN f, UNDO &undo) {
+	int from = from_square(m), to = to_square(m);
+	undo.move = m;
+	undo.captured = pos.board[to];
+	pos.key ^= ZOBRIST.side;
+	remove_piece(pos, to);
+	if (from == to) {
+		put_piece(pos, to, f);
+		pos.key ^= ZOBRIST.hidden[f][pos.coverPieceCount[f]] ^ ZOBRIST.hidden[f][pos.coverPieceCount[f] - 1];
+		pos.coverPieceCount[f]--;
+		pos.allCoverCount--;
+	} else {
+		put_piece(pos, to, pos.board[from]);
+		remove_piece(pos, from);
+		put_piece(pos, from, FIN_EMPTY);
+	}
+}
+
+/// Take back the move recorded in undo
+inline void undo_move(POSITION &pos, const UNDO &undo) {
+	int from = from_square(undo.move), to = to_square(undo.move);
+	FIN f = pos.board[to];
+	pos.key ^= ZOBRIST.side;
+	remove_piece(pos, to);
+	put_piece(pos, to, undo.captured);
+	if (from == to) {
+		pos.key ^= ZOBRIST.hidden[f][pos.coverPieceCount[f]] ^ ZOBRIST.hidden[f][pos.coverPieceCount[f] + 1];
+		pos.coverPieceCount[f]++;
+		pos.allCoverCount++;
+	} else {
+		remove_piece(pos, from);
+		put_piece(pos, from, f);
+	}
+}
+
+/// Enemy pieces an attacker may capture by an adjacent move
+inline BITBOARD capture_targets(const POSITION &pos, FIN attacker) {
+	BITBOARD targets = 0;
+	for (int v = !color_of(attacker); v < FIN_COVER; v += 2) {
+		if (can_capture(attacker, FIN(v))) {
+			targets |= pos.pieces[v];
+		}
+	}
+	return targets;
+}
+
+/// Cannon jumps along one line of n squares: for a cannon at index i and
+/// line occupancy occ, the first occupied square behind a screen each way
+constexpr int line_jumps(int i, int occ, int n) {
+	int jumps = 0;
+	for (int step = -1; step <= 1; step += 2) {
+		int screens = 0;
+		for (int j = i + step; j >= 0 && j < n; j += step) {
+			if ((occ >> j & 1) && screens++) {
+				jumps |= 1 << j;
+				break;
+			}
+		}
+	}
+	return jumps;
+}
+
+/// Cannon jump targets per square and line occupancy
+/// file[] is indexed by rank and holds rank bits, rank[] is indexed by file
+/// and holds the targets already spread onto rank 1
+struct CANNON_TABLE {
+	uint8_t file[ROW_COUNT][1 << ROW_COUNT];
+	BITBOARD rank[COL_COUNT][1 << COL_COUNT];
+};
+
+constexpr CANNON_TABLE make_cannon_table() {
+	CANNON_TABLE t{};
+	for (int r = 0; r < ROW_COUNT; r++) {
+		for (int occ = 0; occ < 1 << ROW_COUNT; occ++) {
+			t.file[r][occ] = uint8_t(line_jumps(r, occ, ROW_COUNT));
+		}
+	}
+	for (int c = 0; c < COL_COUNT; c++) {
+		for (int occ = 0; occ < 1 << COL_COUNT; occ++) {
+			int jumps = line_jumps(c, occ, COL_COUNT);
+			for (int j = 0; j < COL_COUNT; j++) {
+				if (jumps >> j & 1) {
+					t.rank[c][occ] |= square_bb(j * ROW_COUNT);
+				}
+			}
+		}
+	}
+	return t;
+}
+
+static constexpr CANNON_TABLE CANNON = make_cannon_table();
+
+/// Gather the occupancy of a rank into a 4-bit index, file a in bit 0
+inline int rank_occupancy(BITBOARD occupied, int row) {
+	return (((occupied >> row) & BB_RANK1) * 0x01020408) >> 24;
+}
+
+/// Squares a cannon on sq can jump to: the first occupied square behind a screen
+inline BITBOARD cannon_targets(int sq, BITBOARD occupied) {
+	int row = sq % ROW_COUNT, shift = sq - row;
+	return (BITBOARD(CANNON.file[row][(occupied >> shift) & 0xFF]) << shift)
+	     | (CANNON.rank[sq / ROW_COUNT][rank_occupancy(occupied, row)] << row);
+}
+
+/// Upper bound on the number of legal moves in a position
+static const int MAX_MOVES = 128;
+
+/// Move with a slot for its ordering score
+struct SCORED_MOVE {
+	MOVE move;
+	int score;
+
+	operator MOVE() const {
+		return move;
+	}
+};
+
+/// Fixed-capacity move list, meant to live on the stack of a search frame
+struct MOVELIST {
+	SCORED_MOVE moves[MAX_MOVES];
+	int count = 0;
+
+	void push(MOVE m, int score = 0) {
+		moves[count].move = m;
+		moves[count].score = score;
+		count++;
+	}
+	void clear() {
+		count = 0;
+	}
+	int size() const {
+		return count;
+	}
+	bool empty() const {
+		return count == 0;
+	}
+	MOVE operator[](int i) const {
+		return moves[i].move;
+	}
+	SCORED_MOVE *begin() {
+		return moves;
+	}
+	SCORED_MOVE *end() {
+		return moves + count;
+	}
+	const SCORED_MOVE *begin() const {
+		return moves;
+	}
+	const SCORED_MOVE *end() const {
+		return moves + count;
+	}
+};
+
+/// Generate the captures of player: adjacent captures and cannon jumps
+inline void generate_captures(const POSITION &pos, COLOR player, MOVELIST &moves) {
+	if (player != RED && player != BLK) {
+		return;
+	}
+	BITBOARD occupied = ~pos.empty;
+	BITBOARD enemy = pos.colors[!player];
+	for (int f = player; f < FIN_COVER; f += 2) {
+		BITBOARD from = pos.pieces[f];
+		if (!from) {
+			continue;
+		}
+		BITBOARD targets = capture_targets(pos, FIN(f));
+		while (from) {
+			int sq = pop_lsb(from);
+			BITBOARD to = SQUARES.neighborBB[sq] & targets;
+			if (type_of(FIN(f)) == FIN_C) {
+				to |= cannon_targets(sq, occupied) & enemy; /// Cannon capture
+			}
+			while (to) {
+				moves.push(make_move(sq, pop_lsb(to)));
+			}
+		}
+	}
+}
+
+/// Generate the quiet moves of player: flips and moves to empty squares
+inline void generate_quiets(const POSITION &pos, COLOR player, MOVELIST &moves) {
+	for (BITBOARD b = pos.covered; b; ) {
+		int sq = pop_lsb(b);
+		moves.push(make_move(sq, sq)); /// Flip move
+	}
+	if (player != RED && player != BLK) {
+		return;
+	}
+	BITBOARD from = pos.colors[player];
+	while (from) {
+		int sq = pop_lsb(from);
+		for (BITBOARD to = SQUARES.neighborBB[sq] & pos.empty; to; ) {
+			moves.push(make_move(sq, pop_lsb(to)));
+		}
+	}
+}
+
+/// Generate all legal moves of player: flips, adjacent moves and captures, cannon jumps
+inline void generate_moves(const POSITION &pos, COLOR player, MOVELIST &moves) {
+	generate_quiets(pos, player, moves);
+	generate_captures(pos, player, moves);
+}
+
+inline bool is_capture(const POSITION &pos, MOVE m) {
+	return from_square(m) != to_square(m) && pos.board[to_square(m)] != FIN_EMPTY;
+}
+
+/// Whether m is a legal move of player, for moves taken from outside the generator
+inline bool is_legal(const POSITION &pos, COLOR player, MOVE m) {
+	if (m < 0 || m >= MOVE_NULL) {
 		return false;
-	case FIN_P:
-		return victim == FIN_K || victim == FIN_P;
-	default:
+	}
+	int from = from_square(m), to = to_square(m);
+	if (from == to) {
+		return pos.board[from] == FIN_COVER;
+	}
+	FIN f = pos.board[from];
+	if ((player != RED && player != BLK) || color_of(f) != player) {
 		return false;
 	}
+	if ((SQUARES.neighborBB[from] & square_bb(to)) && can_capture(f, pos.board[to])) {
+		return true;
+	}
+	return type_of(f) == FIN_C && (cannon_targets(from, ~pos.empty) & pos.colors[!player] & square_bb(to));
 }
 
 #endif
\ No newline at end of file
@@ -27,13 +27,27 @@ const char* commands_name[COMMAND_NUM] = {
     "init_board"
 };
 
-int main() {
+int main(int argc, char *argv[]) {
     std::string write;
 	char read[1024], *token;
     const char *data[100];
     int id, i;
     MyAI myai;
 
+    // Startup options: -hash <MB>, -threads <count>
+    for (i = 1; i + 1 < argc; i += 2) {
+        int value;
+        if (sscanf(argv[i + 1], "%d", &value) != 1) {
+            fprintf(stderr, "ignoring option %s: %s is not a number\n", argv[i], argv[i + 1]);
+            continue;
+        }
+        if (strcmp(argv[i], "-hash") == 0) {
+            myai.SetHashSize(value);
+        } else if (strcmp(argv[i], "-threads") == 0) {
+            myai.SetThreads(value);
+        }
+    }
+
     // Game Loop
     do {
         write.clear();
@@ -117,7 +131,7 @@ int main() {
             break;
         case 16: // time_left
         {
-            COLOR color = strcmp(data[0], "red") == 1 ? RED : BLK;
+            COLOR color = strcmp(data[0], "red") == 0 ? RED : BLK;
             int time;
             sscanf(data[1], "%d", &time);
             myai.SetTime(color, time);
@@ -0,0 +1,64 @@
+// Checks that a fixed-depth search makes no heap allocation: every search
+// structure lives on the stack or is allocated before the search starts.
+// Build from the repository root and run:
+//   g++ -std=c++17 -O2 -pthread APBT/tests/alloc_test.cpp APBT/MyAI.cpp -o alloc_test && ./alloc_test
+#include <stdio.h>
+#include <stdlib.h>
+#include <new>
+
+#include "../MyAI.h"
+
+static long allocations = 0;
+
+void *operator new(size_t size) {
+    allocations++;
+    void *p = malloc(size ? size : 1);
+    if (p == nullptr) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void *operator new[](size_t size) {
+    return operator new(size);
+}
+
+void operator delete(void *p) noexcept {
+    free(p);
+}
+
+void operator delete[](void *p) noexcept {
+    free(p);
+}
+
+void operator delete(void *p, size_t) noexcept {
+    free(p);
+}
+
+void operator delete[](void *p, size_t) noexcept {
+    free(p);
+}
+
+int main() {
+    MyAI ai;
+    // A midgame: both kings, cannons and a few more pieces revealed
+    const char *flips[][2] = {{"a1", "K"}, {"b2", "k"}, {"c3", "C"}, {"d4", "c"}, {"a5", "P"},
+                              {"b6", "p"}, {"c7", "R"}, {"d8", "n"}, {"a3", "G"}, {"b4", "m"}};
+    for (auto &flip : flips) {
+        ai.Flip(string2square(flip[0]), char2fin(flip[1][0]));
+    }
+    ai.SetColor(RED);
+    ai.SetThreads(1);
+
+    allocations = 0;
+    MOVE move = ai.GenerateMove(); // No clock: searches to the default depth
+    long searchAllocations = allocations;
+
+    printf("move %s, %ld heap allocations\n", to_string(move).c_str(), searchAllocations);
+    if (move == MOVE_NULL || searchAllocations != 0) {
+        printf("FAILED\n");
+        return 1;
+    }
+    printf("passed\n");
+    return 0;
+}
@@ -6,40 +6,134 @@
 #include <cmath>
 #include <limits>
 #include <iostream>
+#include <atomic>
+#include <thread>
+#include <new>
+#include <unordered_map>
+#include <queue>
 
 #include "libchess.h"
 #include "MyAI.h"
 using namespace std;
 
-// MCTS Node structure
-struct Node {
-    FIN board[BOARD_SIZE];
-    int color;
-    MOVE move;
-    Node* parent;
-    vector<Node*> children;
-    int visitCount;
-    float score;
-    int pieceScore; 
-    
-    Node(const FIN b[BOARD_SIZE], int c, MOVE m, Node* p) :
-        parent(p), visitCount(0), score(0.0f), pieceScore(0) {
-         memcpy(board, b, sizeof(FIN) * BOARD_SIZE);
-        color = c;
-        move = m;
+static const int pieceValues[FIN_COVER] = {1000, 1000, 700, 700, 600, 600, 500, 500, 400, 400, 300, 300, 200, 200};
+
+// Add to an atomic float, there is no fetch_add for floats before C++20
+void atomicAdd(std::atomic<float> &target, float value) {
+    float current = target.load(std::memory_order_relaxed);
+    while (!target.compare_exchange_weak(current, current + value, std::memory_order_relaxed)) {
     }
-    
-    ~Node() {
-       for(Node* child : children){
-          delete child;
-       }
+}
+
+// Index of the first of count nodes, NODE_NONE when the pool is full.
+// Blocks never cross a slab, so the children of a node are contiguous
+uint32_t NodePool::allocate(Cursor &cursor, int count) {
+    if (cursor.next + count > cursor.end) {
+        int index = slabCount.fetch_add(1, std::memory_order_relaxed);
+        if (index >= maxSlabs) {
+            return NODE_NONE;
+        }
+        if (!slabs[index]) {
+            slabs[index].reset(new Slab);
+        }
+        cursor.next = (uint32_t)index << SLAB_BITS;
+        cursor.end = cursor.next + SLAB_NODES;
     }
+    uint32_t first = cursor.next;
+    cursor.next += count;
+    return first;
+}
+
+// Set up a freshly allocated node
+void NodePool::init(uint32_t node, MOVE move, FIN flip) {
+    Slab &s = slab(node);
+    int i = offset(node);
+    s.move[i] = move;
+    s.flip[i] = flip;
+    s.childCount[i] = 0;
+    s.firstChild[i] = NODE_NONE;
+    s.state[i].store(NODE_LEAF, std::memory_order_relaxed);
+    s.tried[i].store(0, std::memory_order_relaxed);
+    s.visitCount[i].store(0, std::memory_order_relaxed);
+    s.score[i].store(0.0f, std::memory_order_relaxed);
+    s.virtualLoss[i].store(0, std::memory_order_relaxed);
+    s.amafVisits[i].store(0, std::memory_order_relaxed);
+    s.amafScore[i].store(0.0f, std::memory_order_relaxed);
+    s.proof[i].store(PROOF_NONE, std::memory_order_relaxed);
+    s.link[i] = node;
+}
 
-   float ucb1(float c = 1.414) const {
-        if(visitCount == 0) return std::numeric_limits<float>::infinity();
-        return score / visitCount + c * std::sqrt(std::log(parent->visitCount) / visitCount);
+// Copy move, flip and statistics of node in source to copy, with the state
+// and proof of its position, not the children. The copy keeps the position
+void NodePool::copyNode(NodePool &source, uint32_t node, uint32_t copy) {
+    Slab &s = source.slab(node);
+    int i = offset(node);
+    Slab &p = source.slab(source.link(node));
+    int n = offset(source.link(node));
+    Slab &t = slab(copy);
+    int j = offset(copy);
+    t.move[j] = s.move[i];
+    t.flip[j] = s.flip[i];
+    t.childCount[j] = 0;
+    t.firstChild[j] = NODE_NONE;
+    t.state[j].store(p.state[n].load(std::memory_order_relaxed), std::memory_order_relaxed);
+    t.tried[j].store(p.tried[n].load(std::memory_order_relaxed), std::memory_order_relaxed);
+    t.visitCount[j].store(s.visitCount[i].load(std::memory_order_relaxed), std::memory_order_relaxed);
+    t.score[j].store(s.score[i].load(std::memory_order_relaxed), std::memory_order_relaxed);
+    t.virtualLoss[j].store(0, std::memory_order_relaxed);
+    t.amafVisits[j].store(s.amafVisits[i].load(std::memory_order_relaxed), std::memory_order_relaxed);
+    t.amafScore[j].store(s.amafScore[i].load(std::memory_order_relaxed), std::memory_order_relaxed);
+    t.proof[j].store(p.proof[n].load(std::memory_order_relaxed), std::memory_order_relaxed);
+    t.link[j] = copy;
+}
+
+// Release every node at once, the slabs are kept for the next search. A new
+// generation empties the position table
+void NodePool::reset() {
+    slabCount.store(0, std::memory_order_relaxed);
+    if (!table) {
+        table.reset(new Entry[tableMask + 1]());
     }
-};
+    generation++;
+}
+
+// Hold at most nodes, rounded up to whole slabs. Slabs past the capacity are
+// freed, and the table is sized to about one entry per two nodes. Only
+// between searches
+void NodePool::setCapacity(uint32_t nodes) {
+    uint64_t slabsNeeded = ((uint64_t)nodes + SLAB_NODES - 1) / SLAB_NODES;
+    maxSlabs = slabsNeeded < MAX_SLABS ? (int)slabsNeeded : MAX_SLABS;
+    for (int k = maxSlabs; k < MAX_SLABS; k++) {
+        slabs[k].reset();
+    }
+    size_t entries = 1024;
+    while (entries < nodes / 2 && entries < (1 << TABLE_BITS)) {
+        entries *= 2;
+    }
+    if (entries != tableMask + 1) {
+        table.reset();
+        tableMask = entries - 1;
+    }
+}
+
+// Node keeping the position of key, NODE_NONE when the table has none. The
+// table is lossy: a position that lost its entry just gets a new node
+uint32_t NodePool::find(uint64_t key) const {
+    const Entry &e = table[key & tableMask];
+    uint64_t data = e.data.load(std::memory_order_acquire);
+    if ((e.key.load(std::memory_order_relaxed) ^ data) != key || (uint32_t)(data >> 32) != generation) {
+        return NODE_NONE;
+    }
+    return (uint32_t)data;
+}
+
+// Make node the one keeping the position of key, once it is initialized
+void NodePool::insert(uint64_t key, uint32_t node) {
+    Entry &e = table[key & tableMask];
+    uint64_t data = (uint64_t)generation << 32 | node;
+    e.key.store(key ^ data, std::memory_order_relaxed);
+    e.data.store(data, std::memory_order_release);
+}
 
 // Calculate a score from the pieces on the board
 int calculatePieceScore(const FIN board[BOARD_SIZE], int color) {
@@ -83,7 +177,7 @@ int calculatePieceScore(const FIN board[BOARD_SIZE], int color) {
    {
        if (myPieceCount > 1)
        {
-          return std::numeric_limits<int>::max();
+          return WIN_SCORE;
        } else if (myPieceCount == 1) {
            //If my piece is king and enemy is king, then stalemate.
           for(int i = 0; i < BOARD_SIZE; i++)
@@ -95,46 +189,18 @@ int calculatePieceScore(const FIN board[BOARD_SIZE], int color) {
                  }
              }
           }
-          return -std::numeric_limits<int>::max();
+          return -WIN_SCORE;
        }
    }
     return score;
 }
 
 // Generate legal moves
-std::vector<MOVE> generateLegalMoves(const FIN board[BOARD_SIZE], int color) {
-	std::vector<MOVE> moveList;
-	int to, cnt, row, col;
-
-	for (int i = 0; i < BOARD_SIZE; i++) {
-		if (board[i] == FIN_COVER) {
-			moveList.push_back(make_move(i, i));
-		} else if (board[i] != FIN_EMPTY && color_of(board[i]) == color) {
-			row = i % ROW_COUNT;
-			col = i / ROW_COUNT;
-			if (board[i] == FIN_C || board[i] == FIN_c) {
-				for (int delta : {-ROW_COUNT, +1, +ROW_COUNT, -1}) {
-					to = i + delta;
-					cnt = 0;
-					while (to >= 0 && to < BOARD_SIZE && (to % ROW_COUNT == row || to / ROW_COUNT == col)) {
-						cnt += (board[to] != FIN_EMPTY);
-						if (cnt == 2 && color_of(board[to]) == !color) {
-							moveList.push_back(make_move(i, to));
-							break;
-						}
-						to += delta;
-					}
-				}
-			}
-			for (int to : {i-ROW_COUNT, i+1, i+ROW_COUNT, i-1}) {
-				if (to >= 0 && to < BOARD_SIZE && (to % ROW_COUNT == row || to / ROW_COUNT == col)
-				 && can_capture(board[i], board[to])) {
-					moveList.push_back(make_move(i, to));
-				}
-			}
-		}
-	}
-    return moveList;
+void generateLegalMoves(const FIN board[BOARD_SIZE], int color, MOVELIST &moveList) {
+	POSITION pos;
+	set_position(pos, board);
+	moveList.clear();
+	generate_moves(pos, (COLOR)color, moveList);
 }
 
 
@@ -153,7 +219,8 @@ MOVE findWinningCapture(const FIN board[BOARD_SIZE], int color) {
        return MOVE_NULL;
     }
     
-    std::vector<MOVE> moves = generateLegalMoves(board, color);
+    MOVELIST moves;
+    generateLegalMoves(board, color, moves);
     for(MOVE move : moves) {
         int from = from_square(move);
         int to = to_square(move);
@@ -181,82 +248,818 @@ void makeMove(FIN board[BOARD_SIZE], MOVE move) {
     board[from] = FIN_EMPTY;
 }
 
+// Position replayed down a tree path and through a playout
+struct PlayState {
+    FIN board[BOARD_SIZE];
+    int coverPieceCount[14];
+    int allCoverCount;
+    int toMove;
+    uint64_t key; // Zobrist key, kept along the tree moves only
+};
+
+// Position to search from
+PlayState makeState(const FIN board[BOARD_SIZE], const int coverPieceCount[14], int toMove) {
+    PlayState state;
+    POSITION pos;
+    set_position(pos, board, coverPieceCount, toMove == BLK ? BLK : RED);
+    memcpy(state.board, board, sizeof(FIN) * BOARD_SIZE);
+    memcpy(state.coverPieceCount, coverPieceCount, sizeof(int) * 14);
+    state.allCoverCount = pos.allCoverCount;
+    state.toMove = toMove;
+    state.key = pos.key;
+    return state;
+}
+
+// Reveal f on the covered square sq
+void playFlip(PlayState &state, int sq, FIN f) {
+    state.board[sq] = f;
+    state.coverPieceCount[f]--;
+    state.allCoverCount--;
+}
 
-// Perform a simulation from a given node
-float simulate(Node* node, int color, int simulation_depth) {
-     FIN simBoard[BOARD_SIZE];
-    memcpy(simBoard, node->board, sizeof(FIN) * BOARD_SIZE);
+// Draw the piece under a cover, by the covered pieces left of each kind
+FIN sampleFlip(const int coverPieceCount[FIN_COVER], int allCoverCount, Random &rng) {
+    int r = rng.bounded(allCoverCount);
+    int f = 0;
+    while (f < FIN_COVER - 1 && r >= coverPieceCount[f]) {
+        r -= coverPieceCount[f];
+        f++;
+    }
+    return FIN(f);
+}
 
-    int current_color = node->color;
-    for(int depth = 0; depth < simulation_depth; depth++){
-       std::vector<MOVE> possibleMoves = generateLegalMoves(simBoard, current_color);
-        if(possibleMoves.empty()){
-           break;
+// A flip node whose piece is not known yet: its children are the outcomes
+bool isChanceNode(MOVE move, FIN flip) {
+    return from_square(move) == to_square(move) && flip == FIN_EMPTY;
+}
+
+// Key of the position after a move, flip the piece it reveals. Not for a
+// chance node, its piece is not known yet
+uint64_t moveKey(const PlayState &state, MOVE move, FIN flip) {
+    int from = from_square(move);
+    int to = to_square(move);
+    uint64_t key = state.key ^ ZOBRIST.side;
+    if (from == to) {
+        int left = state.coverPieceCount[flip];
+        return key ^ ZOBRIST.piece[FIN_COVER][to] ^ ZOBRIST.piece[flip][to]
+                   ^ ZOBRIST.hidden[flip][left] ^ ZOBRIST.hidden[flip][left - 1];
+    }
+    FIN piece = state.board[from];
+    return key ^ ZOBRIST.piece[piece][from] ^ ZOBRIST.piece[FIN_EMPTY][from]
+               ^ ZOBRIST.piece[state.board[to]][to] ^ ZOBRIST.piece[piece][to];
+}
+
+// Replay the move of a tree node. A chance node only picks the square, the
+// outcome node below it reveals the piece and ends the move
+void playNodeMove(PlayState &state, MOVE move, FIN flip) {
+    if (isChanceNode(move, flip)) {
+        return;
+    }
+    state.key = moveKey(state, move, flip);
+    if (from_square(move) == to_square(move)) {
+        playFlip(state, to_square(move), flip);
+    } else {
+        makeMove(state.board, move);
+    }
+    state.toMove = state.toMove == RED ? BLK : RED;
+}
+
+
+// Set of moves, one bit per MOVE value
+struct MoveSet {
+    uint64_t bits[MOVE_NULL / 64];
+
+    void add(MOVE m) {
+        bits[m >> 6] |= 1ULL << (m & 63);
+    }
+    bool contains(MOVE m) const {
+        return (bits[m >> 6] >> (m & 63)) & 1;
+    }
+};
+
+// Whether the quiet move m puts its piece where an enemy can take it on the
+// next move: next to a piece able to capture it, or on a cannon's jump
+bool isExposed(const POSITION &pos, COLOR side, MOVE m) {
+    int from = from_square(m);
+    int to = to_square(m);
+    if (from == to) {
+        return false; // A flip, the piece is not known
+    }
+    FIN piece = pos.board[from];
+    BITBOARD attackers = 0;
+    for (int v = !side; v < FIN_COVER; v += 2) {
+        if (can_capture(FIN(v), piece)) {
+            attackers |= pos.pieces[v];
         }
-        
-        std::random_device rd;
-        std::mt19937 gen(rd());
-        std::uniform_int_distribution<> distrib(0, possibleMoves.size() - 1);
-
-        MOVE selectedMove = possibleMoves[distrib(gen)];
-         makeMove(simBoard, selectedMove);
-         
-        current_color = current_color == RED ? BLK : RED;
-     }
-     
-    return calculatePieceScore(simBoard, color);
-}
-
-// MCTS selection
-Node* select(Node* node) {
-    while (!node->children.empty()) {
-         Node* selectedChild = nullptr;
-        float bestUcb1 = -std::numeric_limits<float>::infinity();
-        for(Node* child : node->children) {
-           float ucb1 = child->ucb1();
-           if(ucb1 > bestUcb1)
-           {
-              bestUcb1 = ucb1;
-              selectedChild = child;
-           }
+    }
+    if (SQUARES.neighborBB[to] & attackers) {
+        return true;
+    }
+    BITBOARD occupied = (~pos.empty & ~square_bb(from)) | square_bb(to);
+    for (BITBOARD cannons = pos.pieces[FIN_C + !side]; cannons; ) {
+        if (cannon_targets(pop_lsb(cannons), occupied) & square_bb(to)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Heavy playout policy: the capture of the most valuable piece, ties at
+// random, else a quiet move or flip at random among those that do not expose
+// the piece, else any quiet move. MOVE_NULL when side has no move
+MOVE playoutMove(const POSITION &pos, COLOR side, Random &rng) {
+    MOVELIST moves;
+    generate_captures(pos, side, moves);
+    if (!moves.empty()) {
+        MOVE best = MOVE_NULL;
+        int bestValue = -1;
+        int ties = 0;
+        for (MOVE m : moves) {
+            int value = pieceValues[pos.board[to_square(m)]];
+            if (value > bestValue) {
+                best = m;
+                bestValue = value;
+                ties = 1;
+            } else if (value == bestValue && rng.bounded(++ties) == 0) {
+                best = m;
+            }
+        }
+        return best;
+    }
+    generate_quiets(pos, side, moves);
+    if (moves.empty()) {
+        return MOVE_NULL;
+    }
+    int safe = 0;
+    for (int k = 0; k < moves.size(); k++) {
+        if (!isExposed(pos, side, moves[k])) {
+            moves.moves[safe++] = moves.moves[k];
+        }
+    }
+    return moves[rng.bounded(safe > 0 ? safe : moves.size())];
+}
+
+// Perform a heavy playout from a given position on bitboards, flips reveal a
+// piece drawn from the covered pieces left. The moves are added to played, by
+// side, unless it is null
+float simulate(const PlayState &state, int color, int simulation_depth, Random &rng, MoveSet *played) {
+    POSITION pos;
+    set_position(pos, state.board, state.coverPieceCount);
+    int toMove = state.toMove;
+    UNDO undo;
+    for (int depth = 0; depth < simulation_depth; depth++) {
+        MOVE move = playoutMove(pos, (COLOR)toMove, rng);
+        if (move == MOVE_NULL) {
+            return toMove == color ? -WIN_SCORE : WIN_SCORE; // No move left loses
+        }
+        if (played != nullptr) {
+            played[toMove].add(move);
+        }
+        bool flip = from_square(move) == to_square(move);
+        do_move(pos, move, flip ? sampleFlip(pos.coverPieceCount, pos.allCoverCount, rng) : FIN_EMPTY, undo);
+        toMove = toMove == RED ? BLK : RED;
+    }
+    return calculatePieceScore(pos.board, color);
+}
+
+// Batched playouts: PLAYOUT_LANES positions advanced in lockstep. A square
+// holds one byte per position, so the moves of all positions are found with
+// the same vector operations, GCC vector extensions that compile to SIMD.
+// The policy is the one of playoutMove()
+typedef uint8_t Lanes8 __attribute__((vector_size(PLAYOUT_LANES)));
+typedef uint16_t Lanes16 __attribute__((vector_size(2 * PLAYOUT_LANES)));
+typedef uint64_t Lanes64 __attribute__((vector_size(2 * PLAYOUT_LANES)));
+
+struct PlayoutBatch {
+    Lanes8 board[BOARD_SIZE]; // FIN of each square, one lane per position
+    Lanes8 side;              // Side to move
+    int coverPieceCount[PLAYOUT_LANES][FIN_COVER];
+    int allCoverCount[PLAYOUT_LANES];
+    int count = 0;            // Lanes in use
+};
+
+// Put a position in the next lane of batch
+void addPlayout(PlayoutBatch &batch, const PlayState &state) {
+    int lane = batch.count++;
+    for (int sq = 0; sq < BOARD_SIZE; sq++) {
+        batch.board[sq][lane] = state.board[sq];
+    }
+    batch.side[lane] = state.toMove;
+    memcpy(batch.coverPieceCount[lane], state.coverPieceCount, sizeof(int) * FIN_COVER);
+    batch.allCoverCount[lane] = state.allCoverCount;
+}
+
+// Whether some lane of m is set
+inline bool anyLane(Lanes8 m) {
+    uint64_t words[PLAYOUT_LANES / 8];
+    memcpy(words, &m, sizeof(m));
+    uint64_t any = 0;
+    for (uint64_t w : words) {
+        any |= w;
+    }
+    return any != 0;
+}
+
+// Adjacent capture rule of TYPE_CAPTURE on piece ranks, K = 0 to P = 6:
+// a rank takes the same or lower ranks, but the king not the pawn, the pawn
+// only the king and the pawn, and the cannon nothing
+inline Lanes8 captureRule(Lanes8 attacker, Lanes8 victim) {
+    Lanes8 byRank = (Lanes8)(attacker <= victim) & ~((Lanes8)(attacker == 0) & (Lanes8)(victim == 6));
+    return (byRank & ~(Lanes8)(attacker == 5)) | ((Lanes8)(attacker == 6) & (Lanes8)(victim == 0));
+}
+
+// Keep in best the higher sort key, per lane, of best and a move. The key has
+// the category in the top 4 bits (captures 3 to 9 by victim, 2 a safe quiet
+// move or flip, 1 an exposed quiet move, 0 none), bits 8 to 11 of random,
+// then the move code XORed with a random byte per lane so ties fall at random
+inline void raiseBest(Lanes16 &best, Lanes8 category, const Lanes16 &random, int code, const Lanes16 &shuffle) {
+    Lanes16 key = (__builtin_convertvector(category, Lanes16) << 12) | (random & 0x0F00) | (shuffle ^ (uint16_t)code);
+    best = key > best ? key : best;
+}
+
+// Advance every position of batch by at most depth plies and score it like
+// simulate(). played[lane], unless null, receives the moves of each lane
+void simulateBatch(PlayoutBatch &batch, int color, int depth, Random &rng, MoveSet (*played)[2],
+                   float scores[PLAYOUT_LANES]) {
+    Lanes64 random;
+    for (int k = 0; k < PLAYOUT_LANES / 4; k++) {
+        random[k] = rng.next();
+    }
+    Lanes8 active = {};
+    for (int lane = 0; lane < batch.count; lane++) {
+        active[lane] = 0xFF;
+    }
+    for (int ply = 0; ply < depth && anyLane(active); ply++) {
+        // Per square: who holds it, the enemies next to it that could take a
+        // piece moving there, and the enemy cannons jumping to it by
+        // direction, over one screen or over two of which the mover may be one
+        Lanes8 own[BOARD_SIZE], enemy[BOARD_SIZE], rank[BOARD_SIZE], minRank[BOARD_SIZE];
+        Lanes8 kingNear[BOARD_SIZE], pawnNear[BOARD_SIZE];
+        Lanes8 jumpOne[BOARD_SIZE][DIRECTION_COUNT] = {}, jumpTwo[BOARD_SIZE][DIRECTION_COUNT] = {};
+        for (int sq = 0; sq < BOARD_SIZE; sq++) {
+            Lanes8 b = batch.board[sq];
+            Lanes8 piece = (Lanes8)(b < (uint8_t)FIN_COVER);
+            own[sq] = piece & (Lanes8)((b & 1) == batch.side) & active;
+            enemy[sq] = piece & (Lanes8)((b & 1) != batch.side);
+            rank[sq] = b >> 1;
+        }
+        for (int sq = 0; sq < BOARD_SIZE; sq++) {
+            Lanes8 low = {}, king = {}, pawn = {};
+            low += 7;
+            for (int k = 0; k < SQUARES.neighborCount[sq]; k++) {
+                int w = SQUARES.neighbors[sq][k];
+                Lanes8 r = rank[w] | ~enemy[w]; // 0xFF where no enemy
+                Lanes8 plain = (Lanes8)(r != 0) & (Lanes8)(r != 5);
+                Lanes8 candidate = (r & plain) | (~plain & 7);
+                low = candidate < low ? candidate : low;
+                king |= (Lanes8)(r == 0);
+                pawn |= (Lanes8)(r == 6);
+            }
+            minRank[sq] = low;
+            kingNear[sq] = king;
+            pawnNear[sq] = pawn;
+            Lanes8 cannon = enemy[sq] & (Lanes8)(rank[sq] == FIN_C / 2);
+            if (!anyLane(cannon)) {
+                continue;
+            }
+            for (int d = 0; d < DIRECTION_COUNT; d++) {
+                Lanes8 screens = {};
+                for (int k = 0; k < SQUARES.rayLength[sq][d]; k++) {
+                    int to = SQUARES.rays[sq][d][k];
+                    jumpOne[to][d] |= cannon & (Lanes8)(screens == 1);
+                    jumpTwo[to][d] |= cannon & (Lanes8)(screens == 2);
+                    screens += (Lanes8)(batch.board[to] != (uint8_t)FIN_EMPTY) & 1;
+                }
+            }
+        }
+
+        Lanes16 shuffle = (Lanes16)random & 0xFF;
+        Lanes16 best = {};
+        for (int sq = 0; sq < BOARD_SIZE; sq++) {
+            Lanes8 covered = (Lanes8)(batch.board[sq] == (uint8_t)FIN_COVER) & active;
+            if (!anyLane(own[sq] | covered)) {
+                continue;
+            }
+            random ^= random << 13;
+            random ^= random >> 7;
+            random ^= random << 17;
+            Lanes16 bits = (Lanes16)random;
+            raiseBest(best, covered & 2, bits << 8, sq * 8, shuffle);
+            Lanes8 mover = rank[sq];
+            for (int d = 0; d < DIRECTION_COUNT; d++) {
+                if (SQUARES.rayLength[sq][d] == 0) {
+                    continue;
+                }
+                int to = SQUARES.rays[sq][d][0];
+                Lanes8 quiet = own[sq] & (Lanes8)(batch.board[to] == (uint8_t)FIN_EMPTY);
+                Lanes8 capture = own[sq] & enemy[to] & captureRule(mover, rank[to]);
+                // A cannon jumping along the move loses the mover as a screen
+                Lanes8 exposed = (Lanes8)(minRank[to] <= mover) | (kingNear[to] & (Lanes8)(mover != 6))
+                               | (pawnNear[to] & (Lanes8)(mover == 0)) | jumpTwo[to][d];
+                for (int e = 0; e < DIRECTION_COUNT; e++) {
+                    if (e != d) {
+                        exposed |= jumpOne[to][e];
+                    }
+                }
+                Lanes8 category = (capture & (9 - rank[to])) | (quiet & (2 - (exposed & 1)));
+                raiseBest(best, category, (bits >> (4 * d)) << 8, sq * 8 + d, shuffle);
+            }
+            Lanes8 cannon = own[sq] & (Lanes8)(mover == FIN_C / 2);
+            if (!anyLane(cannon)) {
+                continue;
+            }
+            for (int d = 0; d < DIRECTION_COUNT; d++) {
+                Lanes8 screens = {};
+                for (int k = 0; k < SQUARES.rayLength[sq][d]; k++) {
+                    int to = SQUARES.rays[sq][d][k];
+                    Lanes8 occupied = (Lanes8)(batch.board[to] != (uint8_t)FIN_EMPTY);
+                    Lanes8 capture = cannon & (Lanes8)(screens == 1) & enemy[to];
+                    raiseBest(best, capture & (9 - rank[to]), (bits >> (4 * d)) << 8, sq * 8 + 4 + d, shuffle);
+                    screens += occupied & 1;
+                }
+            }
+        }
+
+        // Play the chosen move of every lane still running
+        for (int lane = 0; lane < batch.count; lane++) {
+            if (!active[lane]) {
+                continue;
+            }
+            int toMove = batch.side[lane];
+            if (best[lane] < (1 << 12)) {
+                scores[lane] = toMove == color ? -WIN_SCORE : WIN_SCORE; // No move left loses
+                active[lane] = 0;
+                continue;
+            }
+            int code = (best[lane] ^ shuffle[lane]) & 0xFF;
+            int from = code >> 3;
+            int to = from;
+            if (batch.board[from][lane] == FIN_COVER) {
+                int *counts = batch.coverPieceCount[lane];
+                FIN f = sampleFlip(counts, batch.allCoverCount[lane], rng);
+                batch.board[from][lane] = f;
+                counts[f]--;
+                batch.allCoverCount[lane]--;
+            } else if ((code & 7) < DIRECTION_COUNT) {
+                to = SQUARES.rays[from][code & 7][0];
+            } else {
+                int d = (code & 7) - DIRECTION_COUNT;
+                int screens = 0;
+                for (int k = 0; k < SQUARES.rayLength[from][d]; k++) {
+                    int sq = SQUARES.rays[from][d][k];
+                    if (batch.board[sq][lane] != FIN_EMPTY && screens++ == 1) {
+                        to = sq;
+                        break;
+                    }
+                }
+            }
+            if (to != from) {
+                batch.board[to][lane] = batch.board[from][lane];
+                batch.board[from][lane] = FIN_EMPTY;
+            }
+            if (played != nullptr) {
+                played[lane][toMove].add(make_move(from, to));
+            }
+        }
+        batch.side ^= 1;
+    }
+
+    // Material of the lanes still running, as calculatePieceScore() counts it
+    // in hundreds
+    Lanes8 myValue = {}, enemyValue = {}, myCount = {}, enemyCount = {}, myKing = {};
+    for (int sq = 0; sq < BOARD_SIZE; sq++) {
+        Lanes8 b = batch.board[sq];
+        Lanes8 piece = (Lanes8)(b < (uint8_t)FIN_COVER);
+        Lanes8 mine = piece & (Lanes8)((b & 1) == (uint8_t)color);
+        Lanes8 theirs = piece & ~mine;
+        Lanes8 r = b >> 1;
+        Lanes8 value = (8 - r) + ((Lanes8)(r == 0) & 2);
+        myValue += mine & value;
+        enemyValue += theirs & value;
+        myCount -= mine;
+        enemyCount -= theirs;
+        myKing |= mine & (Lanes8)(r == 0);
+    }
+    for (int lane = 0; lane < batch.count; lane++) {
+        if (!active[lane]) {
+            continue;
+        }
+        float score = 100.0f * ((int)myValue[lane] - (int)enemyValue[lane]);
+        if (enemyCount[lane] == 1 && myCount[lane] > 1) {
+            score = WIN_SCORE;
+        } else if (enemyCount[lane] == 1 && myCount[lane] == 1) {
+            score = myKing[lane] ? 0 : -WIN_SCORE; // King against one piece is a stalemate
+        }
+        scores[lane] = score;
+    }
+}
+
+// Child of node with the highest UCB1 for the side to move at node. Scores
+// are kept for the root player, sign is 1 where it moves and -1 where the
+// opponent does, so each side picks its own best reply as the solver assumes.
+// With RAVE the mean is blended with the AMAF mean by
+// beta = sqrt(k / (3n + k)), k the equivalence parameter, so AMAF leads while
+// a child has few visits. Pending visits count as visits that lost
+// VIRTUAL_LOSS each for the side to move. Proven children are skipped. The
+// parent count is the sum over the children, as a shared node is visited from
+// every parent
+uint32_t bestChild(NodePool &pool, uint32_t node, int raveEquivalence, float sign) {
+    NodePool::Slab &s = pool.slab(node);
+    int i = NodePool::offset(node);
+    uint32_t first = s.firstChild[i];
+    int count = s.childCount[i];
+    NodePool::Slab &c = pool.slab(first);
+    int j = NodePool::offset(first);
+
+    // Snapshot the shared statistics of the children, they sit side by side
+    float visits[MAX_MOVES];
+    float total[MAX_MOVES];
+    float amafVisits[MAX_MOVES];
+    float amafTotal[MAX_MOVES];
+    bool proven[MAX_MOVES];
+    float parentVisits = 0;
+    for (int k = 0; k < count; k++) {
+        int pending = c.virtualLoss[j + k].load(std::memory_order_relaxed);
+        visits[k] = (float)(c.visitCount[j + k].load(std::memory_order_relaxed) + pending);
+        total[k] = sign * c.score[j + k].load(std::memory_order_relaxed) - pending * VIRTUAL_LOSS;
+        amafVisits[k] = (float)c.amafVisits[j + k].load(std::memory_order_relaxed);
+        amafTotal[k] = sign * c.amafScore[j + k].load(std::memory_order_relaxed);
+        uint32_t position = c.link[j + k];
+        proven[k] = pool.slab(position).proof[NodePool::offset(position)].load(std::memory_order_relaxed) != PROOF_NONE;
+        parentVisits += visits[k];
+    }
+    float equivalence = (float)raveEquivalence;
+    float logParent = std::log(parentVisits);
+
+    // Branch-free over plain arrays, so the compiler can vectorize it
+    float ucb1[MAX_MOVES];
+    for (int k = 0; k < count; k++) {
+        float beta = amafVisits[k] > 0 ? std::sqrt(equivalence / (3 * visits[k] + equivalence)) : 0.0f;
+        float amafMean = amafVisits[k] > 0 ? amafTotal[k] / amafVisits[k] : 0.0f;
+        ucb1[k] = visits[k] > 0
+                ? (1 - beta) * (total[k] / visits[k]) + beta * amafMean + UCB_C * std::sqrt(logParent / visits[k])
+                : std::numeric_limits<float>::infinity();
+        ucb1[k] = proven[k] ? -std::numeric_limits<float>::infinity() : ucb1[k];
+    }
+    int best = 0;
+    for (int k = 1; k < count; k++) {
+        if (ucb1[k] > ucb1[best]) {
+            best = k;
+        }
+    }
+    return first + best;
+}
+
+// Cheap prior for expansion order: captures by victim value come first
+int movePrior(const FIN board[BOARD_SIZE], MOVE move) {
+    FIN victim = board[to_square(move)];
+    if (from_square(move) == to_square(move) || victim == FIN_EMPTY) {
+        return 0;
+    }
+    return pieceValues[victim];
+}
+
+// Create the children of node as one block of the pool: the legal moves
+// ordered by prior, or for a chance node one outcome per kind of covered piece
+// left. A child whose position is in the table links to the node keeping it,
+// the others are entered in the table. Only by the thread that moved the node
+// to NODE_EXPANDING. Fails when the pool is full
+bool expand(NodePool &pool, NodePool::Cursor &cursor, uint32_t node, const PlayState &state) {
+    NodePool::Slab &s = pool.slab(node);
+    int i = NodePool::offset(node);
+    MOVE nodeMove = (MOVE)s.move[i];
+    MOVELIST possibleMoves;
+    if (isChanceNode(nodeMove, (FIN)s.flip[i])) {
+        for (int f = 0; f < FIN_COVER; f++) {
+            if (state.coverPieceCount[f] > 0) {
+                possibleMoves.push(nodeMove, f);
+            }
+        }
+    } else {
+        generateLegalMoves(state.board, state.toMove, possibleMoves);
+        for (SCORED_MOVE &m : possibleMoves) {
+            m.score = movePrior(state.board, m.move);
+        }
+        // Stable insertion sort, std::stable_sort would allocate a buffer
+        for (int k = 1; k < possibleMoves.size(); k++) {
+            SCORED_MOVE m = possibleMoves.moves[k];
+            int n = k;
+            for (; n > 0 && possibleMoves.moves[n - 1].score < m.score; n--) {
+                possibleMoves.moves[n] = possibleMoves.moves[n - 1];
+            }
+            possibleMoves.moves[n] = m;
+        }
+    }
+    uint32_t first = NODE_NONE;
+    if (!possibleMoves.empty()) {
+        first = pool.allocate(cursor, possibleMoves.size());
+        if (first == NODE_NONE) {
+            return false;
+        }
+    }
+    for (int k = 0; k < possibleMoves.size(); k++) {
+        FIN flip = isChanceNode(nodeMove, (FIN)s.flip[i]) ? FIN(possibleMoves.moves[k].score) : FIN_EMPTY;
+        pool.init(first + k, possibleMoves[k], flip);
+        if (isChanceNode(possibleMoves[k], flip)) {
+            continue;
+        }
+        uint64_t key = moveKey(state, possibleMoves[k], flip);
+        uint32_t position = pool.find(key);
+        if (position != NODE_NONE) {
+            pool.slab(first + k).link[NodePool::offset(first + k)] = position;
+        } else {
+            pool.insert(key, first + k);
+        }
+    }
+    s.firstChild[i] = first;
+    s.childCount[i] = possibleMoves.size();
+    s.state[i].store(NODE_EXPANDED, std::memory_order_release);
+    return true;
+}
+
+// Child of node matching a move and its flip result, NODE_NONE if there is none
+uint32_t findChild(NodePool &pool, uint32_t node, MOVE move, FIN flip) {
+    NodePool::Slab &s = pool.slab(pool.link(node));
+    int i = NodePool::offset(pool.link(node));
+    if (s.state[i].load(std::memory_order_acquire) != NODE_EXPANDED) {
+        return NODE_NONE;
+    }
+    for (uint32_t child = s.firstChild[i]; child != s.firstChild[i] + s.childCount[i]; child++) {
+        NodePool::Slab &c = pool.slab(child);
+        int j = NodePool::offset(child);
+        if (c.move[j] == move && c.flip[j] == flip) {
+            return child;
+        }
+    }
+    return NODE_NONE;
+}
+
+// MCTS selection and expansion from root. A node is expanded on its first
+// visit, then each visit takes its next untried child until all are tried,
+// and only then does UCB1 choose, for the side to move by the scores of
+// color. At a chance node the outcome is drawn by the covered pieces left. The walk stops at the first untried child or
+// first visit of an outcome, a terminal node, or a node another thread is
+// expanding, or a proven node. A child linked to a position expanded through
+// another parent does not stop the walk, it goes on below the shared node,
+// unless the position repeats one on the path. Replays the path on state,
+// stores it in path, adds a virtual loss to every node on it and returns its
+// length
+int select(NodePool &pool, NodePool::Cursor &cursor, uint32_t root, PlayState &state,
+           uint32_t path[MAX_PLY], Random &rng, int raveEquivalence, int color) {
+    uint32_t node = root;
+    uint32_t positions[MAX_PLY]; // Positions of the path, to stop at repetitions
+    int length = 0;
+    positions[length] = pool.link(node);
+    path[length++] = node;
+    pool.slab(node).virtualLoss[NodePool::offset(node)].fetch_add(1, std::memory_order_relaxed);
+    while (length < MAX_PLY) {
+        uint32_t position = pool.link(node);
+        NodePool::Slab &s = pool.slab(position);
+        int i = NodePool::offset(position);
+        if (s.proof[i].load(std::memory_order_relaxed) != PROOF_NONE) {
+            break;
+        }
+        uint8_t nodeState = s.state[i].load(std::memory_order_acquire);
+        if (nodeState == NODE_LEAF) {
+            if (!s.state[i].compare_exchange_strong(nodeState, NODE_EXPANDING, std::memory_order_acquire)) {
+                break;
+            }
+            if (!expand(pool, cursor, position, state)) {
+                s.state[i].store(NODE_LEAF, std::memory_order_release);
+                break;
+            }
+        } else if (nodeState == NODE_EXPANDING) {
+            break;
+        }
+        int count = s.childCount[i];
+        if (count == 0) {
+            break;
+        }
+        bool stopHere = false;
+        if (isChanceNode((MOVE)s.move[i], (FIN)s.flip[i])) {
+            node = findChild(pool, position, (MOVE)s.move[i], sampleFlip(state.coverPieceCount, state.allCoverCount, rng));
+            stopHere = pool.slab(node).visitCount[NodePool::offset(node)].load(std::memory_order_relaxed) == 0;
+        } else {
+            int k = count;
+            if (s.tried[i].load(std::memory_order_relaxed) < count) {
+                k = s.tried[i].fetch_add(1, std::memory_order_relaxed);
+            }
+            if (k < count) {
+                node = s.firstChild[i] + k;
+                stopHere = true;
+            } else {
+                // Scores are for color, the opponent minimizes them
+                float sign = color == UNKNOWN || state.toMove == color ? 1.0f : -1.0f;
+                node = bestChild(pool, position, raveEquivalence, sign);
+            }
+        }
+        NodePool::Slab &c = pool.slab(node);
+        int j = NodePool::offset(node);
+        if (c.link[j] != node) {
+            // A position already expanded elsewhere goes on below the shared node
+            NodePool::Slab &p = pool.slab(c.link[j]);
+            stopHere = stopHere && p.state[NodePool::offset(c.link[j])].load(std::memory_order_acquire) != NODE_EXPANDED;
+            stopHere = stopHere || std::find(positions, positions + length, c.link[j]) != positions + length;
+        }
+        playNodeMove(state, (MOVE)c.move[j], (FIN)c.flip[j]);
+        c.virtualLoss[j].fetch_add(1, std::memory_order_relaxed);
+        positions[length] = c.link[j];
+        path[length++] = node;
+        if (stopHere) {
+            break;
+        }
+    }
+    return length;
+}
+
+
+// MCTS backpropagation along the first length nodes of path
+void backpropagate(NodePool &pool, const uint32_t path[], int length, float score) {
+    for (int k = 0; k < length; k++) {
+        NodePool::Slab &s = pool.slab(path[k]);
+        int i = NodePool::offset(path[k]);
+        s.visitCount[i].fetch_add(1, std::memory_order_relaxed);
+        atomicAdd(s.score[i], score);
+    }
+}
+
+// Side to move at each node of path
+void pathColors(NodePool &pool, const uint32_t path[], int length, int rootColor, int colors[MAX_PLY]) {
+    colors[0] = rootColor;
+    for (int k = 1; k < length; k++) {
+        NodePool::Slab &s = pool.slab(path[k]);
+        int i = NodePool::offset(path[k]);
+        bool chance = isChanceNode((MOVE)s.move[i], (FIN)s.flip[i]);
+        colors[k] = chance ? colors[k - 1] : !colors[k - 1];
+    }
+}
+
+// All-moves-as-first update: at every decision node on path, each child whose
+// move the side to move there played later in the iteration, in the tree or
+// in the playout, counts the playout score. played holds the playout moves
+void updateAmaf(NodePool &pool, const uint32_t path[], int length, const int colors[MAX_PLY], MoveSet played[2], float score) {
+    for (int k = length - 2; k >= 0; k--) {
+        NodePool::Slab &s = pool.slab(pool.link(path[k]));
+        int i = NodePool::offset(pool.link(path[k]));
+        if (isChanceNode((MOVE)s.move[i], (FIN)s.flip[i])) {
+            continue; // Outcomes are drawn, not chosen
+        }
+        NodePool::Slab &next = pool.slab(path[k + 1]);
+        played[colors[k]].add((MOVE)next.move[NodePool::offset(path[k + 1])]);
+        uint32_t first = s.firstChild[i];
+        int count = std::min<int>(s.tried[i].load(std::memory_order_relaxed), s.childCount[i]);
+        NodePool::Slab &c = pool.slab(first);
+        int j = NodePool::offset(first);
+        for (int n = 0; n < count; n++) {
+            if (played[colors[k]].contains((MOVE)c.move[j + n])) {
+                c.amafVisits[j + n].fetch_add(1, std::memory_order_relaxed);
+                atomicAdd(c.amafScore[j + n], score);
+            }
         }
-        node = selectedChild;
     }
-    return node;
 }
 
-// MCTS expansion
-void expand(Node* node) {
-    std::vector<MOVE> possibleMoves = generateLegalMoves(node->board, node->color);
-    for (MOVE move : possibleMoves) {
-        FIN childBoard[BOARD_SIZE];
-        memcpy(childBoard, node->board, sizeof(FIN) * BOARD_SIZE);
-         
-        if (from_square(move) == to_square(move)) {
-            childBoard[to_square(move)] =  char2fin(finEN[rand() % 14]);
+// MCTS-solver: prove the nodes above the last one of path from their children
+// by minimax, proofs are for rootColor. rootColor wins a node it moves at
+// when one child is a win, and loses it when all children are losses, the
+// other way round where the opponent moves. A chance node is proven only when
+// all its outcomes agree. Proofs belong to positions, so a shared node proven
+// here is proven for all its parents. Stops at the first node that stays
+// unproven
+void updateProofs(NodePool &pool, const uint32_t path[], int length, const int colors[MAX_PLY], int rootColor) {
+    for (int k = length - 2; k >= 0; k--) {
+        NodePool::Slab &s = pool.slab(pool.link(path[k]));
+        int i = NodePool::offset(pool.link(path[k]));
+        uint32_t first = s.firstChild[i];
+        int count = s.childCount[i];
+        NodePool::Slab &c = pool.slab(first);
+        int j = NodePool::offset(first);
+        int wins = 0;
+        int losses = 0;
+        for (int n = 0; n < count; n++) {
+            NodePool::Slab &p = pool.slab(c.link[j + n]);
+            int8_t proof = p.proof[NodePool::offset(c.link[j + n])].load(std::memory_order_relaxed);
+            wins += proof == PROOF_WIN;
+            losses += proof == PROOF_LOSS;
+        }
+        int8_t proof = PROOF_NONE;
+        if (isChanceNode((MOVE)s.move[i], (FIN)s.flip[i])) {
+            proof = wins == count ? PROOF_WIN : losses == count ? PROOF_LOSS : PROOF_NONE;
+        } else if (colors[k] == rootColor) {
+            proof = wins > 0 ? PROOF_WIN : losses == count ? PROOF_LOSS : PROOF_NONE;
         } else {
-           makeMove(childBoard, move);
+            proof = losses > 0 ? PROOF_LOSS : wins == count ? PROOF_WIN : PROOF_NONE;
         }
-         
-        int nextColor = node->color == RED ? BLK : RED;
-        Node* child = new Node(childBoard, nextColor, move, node);
-        node->children.push_back(child);
+        if (proof == PROOF_NONE) {
+            break;
+        }
+        s.proof[i].store(proof, std::memory_order_relaxed);
     }
 }
 
+// Remove the virtual loss select() put on the path
+void revertVirtualLoss(NodePool &pool, const uint32_t path[], int length) {
+    for (int k = 0; k < length; k++) {
+        pool.slab(path[k]).virtualLoss[NodePool::offset(path[k])].fetch_sub(1, std::memory_order_relaxed);
+    }
+}
 
-// MCTS backpropagation
-void backpropagate(Node* node, float score, int pieceScore) {
-    while (node != nullptr) {
-        node->visitCount++;
-        node->score += score;
-        node->pieceScore += pieceScore;
-        node = node->parent;
+// Leaves waiting for a batched playout, virtual loss still on their paths
+struct PendingLeaves {
+    PlayoutBatch batch;
+    uint32_t paths[PLAYOUT_LANES][MAX_PLY];
+    int lengths[PLAYOUT_LANES];
+};
+
+// Run the playouts of the pending leaves together and back their results up
+void playPending(NodePool &pool, PendingLeaves &pending, int color, bool rave, Random &rng) {
+    if (pending.batch.count == 0) {
+        return;
+    }
+    MoveSet played[PLAYOUT_LANES][2] = {};
+    float scores[PLAYOUT_LANES];
+    simulateBatch(pending.batch, color, SIMULATION_DEPTH, rng, rave ? played : nullptr, scores);
+    int colors[MAX_PLY];
+    for (int lane = 0; lane < pending.batch.count; lane++) {
+        const uint32_t *path = pending.paths[lane];
+        int length = pending.lengths[lane];
+        backpropagate(pool, path, length, scores[lane]);
+        if (rave) {
+            pathColors(pool, path, length, color, colors);
+            updateAmaf(pool, path, length, colors, played[lane], scores[lane]);
+        }
+        revertVirtualLoss(pool, path, length);
     }
+    pending.batch.count = 0;
 }
 
+// Copy the children of node in source, and all below them, to copy in target.
+// state is the position of node. Nodes are expanded most visited first, until
+// limit nodes are copied, the nodes left unexpanded keep their statistics
+// and lose their subtrees. A position shared by several nodes is copied once
+// and entered in the table of target, the other nodes reaching it link to
+// that copy
+void copyChildren(NodePool &source, uint32_t node, NodePool &target, NodePool::Cursor &cursor, uint32_t copy,
+                  const PlayState &state, uint32_t limit) {
+    struct Pending {
+        int visits;
+        uint32_t node;
+        uint32_t copy;
+        PlayState state;
+
+        bool operator<(const Pending &other) const {
+            return visits < other.visits;
+        }
+    };
+    std::unordered_map<uint32_t, uint32_t> copies = {{source.link(node), copy}}; // Positions copied so far
+    std::priority_queue<Pending> queue;
+    queue.push({0, node, copy, state});
+    uint32_t copied = 1;
+    while (!queue.empty()) {
+        Pending pending = queue.top();
+        queue.pop();
+        NodePool::Slab &s = source.slab(source.link(pending.node));
+        int i = NodePool::offset(source.link(pending.node));
+        NodePool::Slab &t = target.slab(pending.copy);
+        int j = NodePool::offset(pending.copy);
+        int count = s.childCount[i];
+        if (count == 0) {
+            continue;
+        }
+        uint32_t first = copied + count <= limit ? target.allocate(cursor, count) : NODE_NONE;
+        if (first == NODE_NONE) {
+            // Over the limit, keep copy as an unexpanded leaf
+            t.state[j].store(NODE_LEAF, std::memory_order_relaxed);
+            t.tried[j].store(0, std::memory_order_relaxed);
+            continue;
+        }
+        copied += count;
+        t.firstChild[j] = first;
+        t.childCount[j] = count;
+        for (int k = 0; k < count; k++) {
+            uint32_t child = s.firstChild[i] + k;
+            uint32_t childCopy = first + k;
+            target.copyNode(source, child, childCopy);
+            auto found = copies.find(source.link(child));
+            if (found != copies.end()) {
+                target.slab(childCopy).link[NodePool::offset(childCopy)] = found->second;
+                continue;
+            }
+            copies[source.link(child)] = childCopy;
+            NodePool::Slab &c = target.slab(childCopy);
+            int n = NodePool::offset(childCopy);
+            PlayState childState = pending.state;
+            playNodeMove(childState, (MOVE)c.move[n], (FIN)c.flip[n]);
+            if (!isChanceNode((MOVE)c.move[n], (FIN)c.flip[n])) {
+                target.insert(childState.key, childCopy);
+            }
+            queue.push({c.visitCount[n].load(std::memory_order_relaxed), child, childCopy, childState});
+        }
+    }
+}
 
 MyAI::MyAI() {
+	SetSeed(std::random_device{}());
 	InitBoard();
 }
 
@@ -269,6 +1072,7 @@ void MyAI::InitBoard() {
 	time[BLK] = 0;
 	memcpy(coverPieceCount, cover, sizeof(int) * 14);
 	allCoverCount = BOARD_SIZE;
+	root = NODE_NONE;
 	
 	for (int i = 0, sq = 0; i < ROW_COUNT; i++) {
 		for (int j = 0; j < COL_COUNT; j++, sq++) {
@@ -282,7 +1086,8 @@ void MyAI::InitBoard(const char* data[]) {
 	color = UNKNOWN;
 	time[RED] = 0;
 	time[BLK] = 0;
-	allCoverCount = BOARD_SIZE;
+	allCoverCount = 0;
+	root = NODE_NONE;
 	for (int r = ROW_COUNT - 1, i = 0; r >= 0; r--) {
 		for (int c = 0; c < COL_COUNT; c++, i++) {
 			board[r + c * 4] = char2fin(data[i][0]);
@@ -304,6 +1109,7 @@ void MyAI::Move(int from, int to) {
 	}
 	board[to] = board[from];
 	board[from] = FIN_EMPTY;
+	advanceTree(make_move(from, to), FIN_EMPTY);
 }
 
 //Flip a piece and alternate move turn
@@ -318,6 +1124,39 @@ void MyAI::Flip(int sq, FIN f) {
 	board[sq] = f;
 	coverPieceCount[f]--;
 	allCoverCount--;
+	advanceTree(make_move(sq, sq), f);
+}
+
+// Make the spare pool the live one, with the subgraph of root copied over, at
+// most limit nodes and the most visited first, or a new root when there is no
+// tree. The old graph is released at once
+void MyAI::recycleTree(uint32_t limit) {
+    NodePool &pool = pools[!current];
+    pool.reset();
+    NodePool::Cursor cursor;
+    uint32_t newRoot = pool.allocate(cursor, 1);
+    PlayState rootState = makeState(board, coverPieceCount, color);
+    if (root != NODE_NONE) {
+        pool.copyNode(pools[current], root, newRoot);
+        copyChildren(pools[current], root, pool, cursor, newRoot, rootState, limit);
+    } else {
+        pool.init(newRoot, MOVE_NULL, FIN_EMPTY);
+    }
+    pool.insert(rootState.key, newRoot);
+    current = !current;
+    root = newRoot;
+}
+
+// Follow a played move in the search tree. A flip goes through its chance
+// node to the outcome that was revealed, the tree is dropped when it has none
+void MyAI::advanceTree(MOVE move, FIN flip) {
+	if (root == NODE_NONE) {
+		return;
+	}
+	root = findChild(pools[current], root, move, FIN_EMPTY);
+	if (root != NODE_NONE && flip != FIN_EMPTY) {
+		root = findChild(pools[current], root, move, flip);
+	}
 }
 
 void MyAI::SetColor(COLOR c) {
@@ -328,61 +1167,272 @@ void MyAI::SetTime(COLOR c, int t) {
 	time[c] = t;
 }
 
+// MCTS iterations of one search thread, until stop is raised, the pool is
+// full or, without a clock, the shared iteration count runs out. The main
+// thread watches the clock
+void MyAI::searchWorker(uint64_t seed, bool mainThread) {
+    NodePool &pool = pools[current];
+    NodePool::Cursor cursor;
+    Random rng(seed);
+    PlayState rootState = makeState(board, coverPieceCount, color);
+    bool rave = raveEquivalence > 0 && color != UNKNOWN; // The side to move must be known
+    // Batched playouts score for a known side, like the proofs
+    int batchSize = color != UNKNOWN ? playoutBatch : 1;
+    std::unique_ptr<PendingLeaves> pending(new PendingLeaves);
+    NodePool::Slab &rootSlab = pool.slab(root);
+    int rootIndex = NodePool::offset(root);
+    int colors[MAX_PLY];
+    // Stop once the root is proven, there is nothing left to learn, or once
+    // the pool is full and must be recycled
+    while (!stop.load(std::memory_order_relaxed) && rootSlab.proof[rootIndex].load(std::memory_order_relaxed) == PROOF_NONE
+           && !pool.full()) {
+        if (timeLimit == 0 && iterations.fetch_add(1, std::memory_order_relaxed) >= maxIterations) {
+            break;
+        }
+        PlayState state = rootState;
+        uint32_t *path = pending->paths[pending->batch.count];
+        int length = select(pool, cursor, root, state, path, rng, raveEquivalence, color);
+        uint32_t leaf = pool.link(path[length - 1]);
+        NodePool::Slab &s = pool.slab(leaf);
+        int i = NodePool::offset(leaf);
+        int8_t proof = s.proof[i].load(std::memory_order_relaxed);
+        if (proof == PROOF_NONE && color != UNKNOWN
+            && s.state[i].load(std::memory_order_acquire) == NODE_EXPANDED && s.childCount[i] == 0) {
+            // No children: the side to move has no legal move and loses
+            proof = state.toMove == color ? PROOF_LOSS : PROOF_WIN;
+            s.proof[i].store(proof, std::memory_order_relaxed);
+        }
+        if (proof != PROOF_NONE) {
+            backpropagate(pool, path, length, proof * WIN_SCORE);
+            pathColors(pool, path, length, color, colors);
+            updateProofs(pool, path, length, colors, color);
+        } else if (s.state[i].load(std::memory_order_acquire) == NODE_EXPANDED && s.childCount[i] == 0) {
+            backpropagate(pool, path, length, 0);
+        } else if (batchSize > 1) {
+            // The playout waits for the batch, the path keeps its virtual loss
+            int lane = pending->batch.count;
+            pending->lengths[lane] = length;
+            addPlayout(pending->batch, state);
+            if (pending->batch.count == batchSize) {
+                playPending(pool, *pending, color, rave, rng);
+            }
+            if (mainThread) {
+                checkStop();
+            }
+            continue;
+        } else {
+            MoveSet played[2] = {};
+            float score = simulate(state, color, SIMULATION_DEPTH, rng, rave ? played : nullptr);
+            backpropagate(pool, path, length, score);
+            if (rave) {
+                pathColors(pool, path, length, color, colors);
+                updateAmaf(pool, path, length, colors, played, score);
+            }
+        }
+        revertVirtualLoss(pool, path, length);
+        if (mainThread) {
+            checkStop();
+        }
+    }
+    playPending(pool, *pending, color, rave, rng);
+}
+
+// Set the time budget of this move from the clock
+void MyAI::startClock() {
+    startTime = std::chrono::steady_clock::now();
+    stop = false;
+    iterations = 0;
+    // No clock given, or no side yet to read it for on the opening flip: run
+    // maxIterations
+    if (color == UNKNOWN || time[color] <= 0) {
+        timeLimit = 0;
+        return;
+    }
+    int remaining = time[color] - TIME_MARGIN;
+    int movesToGo = 10 + allCoverCount;
+    timeLimit = std::max(1, remaining / movesToGo);
+}
+
+// Milliseconds since startClock()
+int MyAI::elapsed() const {
+    return (int)std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - startTime).count();
+}
+
+// Raise stop when the budget is spent, or when the most visited root child
+// cannot be overtaken by the playouts the rest of the budget would bring. The
+// playout rate is only trusted once the search has run for MIN_STOP_VISITS
+// root visits and a share of its budget
+void MyAI::checkStop() {
+    if (timeLimit == 0) {
+        return;
+    }
+    int used = elapsed();
+    if (used >= timeLimit) {
+        stop = true;
+        return;
+    }
+    NodePool &pool = pools[current];
+    NodePool::Slab &s = pool.slab(root);
+    int i = NodePool::offset(root);
+    if (s.state[i].load(std::memory_order_acquire) != NODE_EXPANDED) {
+        return;
+    }
+    int best = 0;
+    int second = 0;
+    for (uint32_t child = s.firstChild[i]; child != s.firstChild[i] + s.childCount[i]; child++) {
+        int visits = pool.slab(child).visitCount[NodePool::offset(child)].load(std::memory_order_relaxed);
+        if (visits > best) {
+            second = best;
+            best = visits;
+        } else if (visits > second) {
+            second = visits;
+        }
+    }
+    // Visits in progress count: a batched playout holds its leaves back
+    // until the batch is full, with their virtual loss on the root
+    long long gained = s.visitCount[i].load(std::memory_order_relaxed) + s.virtualLoss[i].load(std::memory_order_relaxed)
+                     - startVisits;
+    int searched = used - searchStart;
+    if (gained < MIN_STOP_VISITS || searched * MIN_STOP_SHARE < timeLimit) {
+        return;
+    }
+    long long remaining = gained * (timeLimit - used) / std::max(searched, 1);
+    if (best - second > remaining) {
+        stop = true;
+    }
+}
+
+// RAVE equivalence parameter: the visits at which a child's own mean and its
+// AMAF mean weigh about the same. 0 turns RAVE off
+void MyAI::SetRave(int equivalence) {
+	raveEquivalence = std::max(0, equivalence);
+}
+
+// Leaves a search thread collects before it runs their playouts together
+// with simulateBatch(), 1 plays each one alone. At most PLAYOUT_LANES
+void MyAI::SetPlayoutBatch(int leaves) {
+	playoutBatch = std::min(std::max(leaves, 1), PLAYOUT_LANES);
+}
+
+// Most nodes each of the two pools holds, the live graph and the spare it is
+// recycled into, so memory stays near 2 * nodes * sizeof(NodePool::Slab) /
+// SLAB_NODES. At least 16 slabs. Drops the tree
+void MyAI::SetNodeBudget(uint32_t nodes) {
+	nodeBudget = std::max<uint32_t>(nodes, 16 * NodePool::SLAB_NODES);
+	root = NODE_NONE;
+	pools[0].setCapacity(nodeBudget);
+	pools[1].setCapacity(nodeBudget);
+}
+
+// Seed of the search, a search with one thread is reproducible from it
+void MyAI::SetSeed(uint64_t seed) {
+	random.setSeed(seed);
+}
+
+// Number of search threads sharing the tree, the main thread included
+void MyAI::SetThreads(int n) {
+	threads = std::max(1, n);
+}
+
+
+// Move to play from node: a proven win, else the most visited child, proven
+// losses last. The proof of a child is read from the node keeping its
+// position, a transposed child only links to it
+MOVE MyAI::bestRootMove(NodePool &pool, uint32_t node) const {
+    NodePool::Slab &s = pool.slab(node);
+    uint32_t first = s.firstChild[NodePool::offset(node)];
+    int childCount = s.childCount[NodePool::offset(node)];
+    MOVE bestMove = MOVE_NULL;
+    long long bestRank = -1;
+    for (uint32_t child = first; child != first + childCount; child++) {
+        NodePool::Slab &c = pool.slab(child);
+        int j = NodePool::offset(child);
+        uint32_t position = pool.link(child);
+        int8_t proof = pool.slab(position).proof[NodePool::offset(position)].load();
+        long long rank = c.visitCount[j].load() + ((long long)proof + 1) * std::numeric_limits<int>::max();
+        if (rank > bestRank) {
+            bestRank = rank;
+            bestMove = (MOVE)c.move[j];
+        }
+    }
+    return bestMove;
+}
 
 // Generate the best move using MCTS
-MOVE MyAI::GenerateMove() const {
+MOVE MyAI::GenerateMove() {
 
     // Check for winning capture move
     MOVE winningMove = findWinningCapture(board, color);
      if(winningMove != MOVE_NULL) {
         return winningMove;
     }
+
+    MOVELIST moves;
+    generateLegalMoves(board, color, moves);
+    if (moves.size() == 1) {
+        return moves[0]; // Forced move, keep the clock
+    }
     
-    // MCTS
-    Node* root = new Node(board, color, MOVE_NULL, nullptr);
-    
-    int iteration_count = 1000;
-    int simulation_depth = 10;
-    
-     // MCTS iterations
-    for (int i = 0; i < iteration_count; ++i) {
-        Node* selectedNode = select(root);
-        if (generateLegalMoves(selectedNode->board, selectedNode->color).empty())
-        {
-           backpropagate(selectedNode, 0, calculatePieceScore(selectedNode->board, color));
-           continue;
-        }
-        expand(selectedNode);
-        
-        for (Node* child : selectedNode->children) {
-            float score = simulate(child, color, simulation_depth);
-            backpropagate(child, score, calculatePieceScore(child->board, color));
-        }
+    // MCTS. The subgraph of the current position is kept if the previous
+    // search saw it from the same side. Copying it counts against the clock
+    startClock();
+    if (color != treeColor) {
+        root = NODE_NONE;
     }
+    bool reused = root != NODE_NONE;
+    recycleTree(nodeBudget / 2);
+    treeColor = color;
     
-    // Get best move
-    MOVE bestMove = MOVE_NULL;
-    float bestScore = -std::numeric_limits<float>::infinity();
+    startVisits = pools[current].slab(root).visitCount[NodePool::offset(root)].load();
+    searchStart = elapsed();
+    if (reused) {
+        printf("reuse: %d visits\n", startVisits);
+    }
     
-    for(Node* child : root->children) {
-        float score = (float)child->pieceScore + child->score / child->visitCount; //Total Score
-        if (score > bestScore)
-        {
-           bestScore = score;
-           bestMove = child->move;
+     // MCTS iterations, shared out over the search threads. A full pool is
+     // recycled to half the budget, keeping the most visited nodes
+    int recycled = 0;
+    for (;;) {
+        vector<std::thread> workers;
+        for (int i = 1; i < threads; ++i) {
+            workers.emplace_back(&MyAI::searchWorker, this, random.next(), false);
         }
+        searchWorker(random.next(), true);
+        if (!pools[current].full()) {
+            stop = true;
+        }
+        for (std::thread &worker : workers) {
+            worker.join();
+        }
+        if (stop) {
+            break;
+        }
+        recycleTree(nodeBudget / 2);
+        recycled++;
     }
-    
+    NodePool &pool = pools[current];
+    NodePool::Slab &s = pool.slab(root);
+    uint32_t first = s.firstChild[NodePool::offset(root)];
+    int childCount = s.childCount[NodePool::offset(root)];
+    MOVE bestMove = bestRootMove(pool, root);
     
     printf("legal: ");
-	for (Node* child : root->children) {
-		printf("%s(score: %.2f, visit: %d), ", to_string(child->move).c_str(), (float)child->score / child->visitCount, child->visitCount);
+	for (uint32_t child = first; child != first + childCount; child++) {
+		NodePool::Slab &c = pool.slab(child);
+		int j = NodePool::offset(child);
+		printf("%s(score: %.2f, visit: %d), ", to_string((MOVE)c.move[j]).c_str(), c.score[j].load() / std::max(1, c.visitCount[j].load()), c.visitCount[j].load());
 	}
 	printf("\n");
+	printf("visits %d time %d ms\n", s.visitCount[NodePool::offset(root)].load() - startVisits, elapsed());
+	if (recycled > 0) {
+		printf("recycled %d times\n", recycled);
+	}
+	if (s.proof[NodePool::offset(root)].load() != PROOF_NONE) {
+		printf("proven %s\n", s.proof[NodePool::offset(root)].load() == PROOF_WIN ? "win" : "loss");
+	}
     
    
-   delete root;
-   
    return bestMove;
 }
 
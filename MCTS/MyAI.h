@@ -3,9 +3,170 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <string>
 #include <math.h>
 #include <time.h>
+#include <limits>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <stdint.h>
+#include <chrono>
+
+static const int MAX_PLY = 128; // Longest path a selection descends
+static const float UCB_C = 1.414f; // UCB1 exploration constant
+static const int SIMULATION_DEPTH = 10; // Plies of a playout
+static const int PLAYOUT_LANES = 16; // Playouts run together by simulateBatch()
+static const int TIME_MARGIN = 100; // ms kept back for protocol overhead
+static const int MIN_STOP_VISITS = 1000; // Root visits a search gains before it may stop early
+static const int MIN_STOP_SHARE = 20; // Nor before 1 / MIN_STOP_SHARE of its budget is spent
+static const int WIN_SCORE = 10000; // Score of a won game, above any material balance
+
+// Score a pending visit counts for during selection, so that threads
+// searching at the same time spread over different paths
+static const float VIRTUAL_LOSS = 1000.0f;
+
+// Expansion state of a node, children may only be read once NODE_EXPANDED
+enum NodeState : uint8_t {
+	NODE_LEAF,
+	NODE_EXPANDING,
+	NODE_EXPANDED,
+};
+
+// Game result a node is proven to have, for the side the tree is scored for
+enum Proof : int8_t {
+	PROOF_LOSS = -1,
+	PROOF_NONE = 0,
+	PROOF_WIN = 1,
+};
+
+static const uint32_t NODE_NONE = 0xFFFFFFFF;
+
+// xoshiro256** generator, one per search thread. Cheap enough to draw every
+// playout move, and reproducible from a seed
+class Random {
+public:
+	explicit Random(uint64_t seed = 0) {
+		setSeed(seed);
+	}
+
+	void setSeed(uint64_t seed) {
+		for (uint64_t &word : state) {
+			word = splitmix64(seed);
+		}
+	}
+
+	uint64_t next() {
+		uint64_t result = rotl(state[1] * 5, 7) * 9;
+		uint64_t t = state[1] << 17;
+		state[2] ^= state[0];
+		state[3] ^= state[1];
+		state[1] ^= state[2];
+		state[0] ^= state[3];
+		state[2] ^= t;
+		state[3] = rotl(state[3], 45);
+		return result;
+	}
+
+	// Uniform in [0, range): Lemire's multiply-shift, with rejection of the
+	// few products that would bias it
+	uint32_t bounded(uint32_t range) {
+		uint64_t product = (next() >> 32) * range;
+		uint32_t low = (uint32_t)product;
+		if (low < range) {
+			uint32_t threshold = (0u - range) % range;
+			while (low < threshold) {
+				product = (next() >> 32) * range;
+				low = (uint32_t)product;
+			}
+		}
+		return (uint32_t)(product >> 32);
+	}
+
+private:
+	static uint64_t rotl(uint64_t x, int k) {
+		return (x << k) | (x >> (64 - k));
+	}
+
+	uint64_t state[4];
+};
+
+// MCTS graph shared by all search threads. A node is a 32-bit index and keeps
+// no position, that is rebuilt by replaying the moves from the root. Nodes are
+// stored as a structure of arrays in slabs, and the children of a node are one
+// block, so their statistics sit side by side for the UCB1 scan.
+// A node is the edge from its parent: move, flip and statistics belong to it.
+// State, children and proof belong to the position, and are kept by the first
+// node that reached it. Nodes reaching it later by another move order link to
+// that node, found through a hash table of position keys.
+// A reset frees the whole graph in O(1). The pool holds at most its capacity,
+// in whole slabs, and reports full once an allocation is refused
+class NodePool {
+public:
+	static const int SLAB_BITS = 12;
+	static const int SLAB_NODES = 1 << SLAB_BITS; // More than any node has children
+	static const int MAX_SLABS = 4096;
+	static const int TABLE_BITS = 20; // Largest table
+
+	struct Slab {
+		uint16_t move[SLAB_NODES];
+		uint8_t flip[SLAB_NODES]; // Piece revealed by a flip move
+		uint8_t childCount[SLAB_NODES];
+		uint32_t firstChild[SLAB_NODES];
+		std::atomic<uint8_t> state[SLAB_NODES];
+		std::atomic<uint8_t> tried[SLAB_NODES]; // Children handed out so far, in block order
+		std::atomic<int> visitCount[SLAB_NODES];
+		std::atomic<float> score[SLAB_NODES];
+		std::atomic<int> virtualLoss[SLAB_NODES]; // Visits in progress below the node
+		std::atomic<int> amafVisits[SLAB_NODES]; // Playouts where the move was played later
+		std::atomic<float> amafScore[SLAB_NODES];
+		std::atomic<int8_t> proof[SLAB_NODES];
+		uint32_t link[SLAB_NODES]; // Node keeping the position, the node itself when it was first
+	};
+
+	// Slab range a search thread allocates from, so threads do not contend
+	struct Cursor {
+		uint32_t next = 0;
+		uint32_t end = 0;
+	};
+
+	uint32_t allocate(Cursor &cursor, int count);
+	void init(uint32_t node, MOVE move, FIN flip);
+	void copyNode(NodePool &source, uint32_t node, uint32_t copy);
+	void reset();
+	void setCapacity(uint32_t nodes);
+	bool full() const {
+		return slabCount.load(std::memory_order_relaxed) > maxSlabs;
+	}
+	uint32_t find(uint64_t key) const;
+	void insert(uint64_t key, uint32_t node);
+
+	Slab &slab(uint32_t node) {
+		return *slabs[node >> SLAB_BITS];
+	}
+	static int offset(uint32_t node) {
+		return node & (SLAB_NODES - 1);
+	}
+	uint32_t link(uint32_t node) {
+		return slab(node).link[offset(node)];
+	}
+
+private:
+	// data packs the generation (32 bits) and the node (32), key holds the
+	// position key XORed with data. Entries of an older generation are empty
+	struct Entry {
+		std::atomic<uint64_t> key;
+		std::atomic<uint64_t> data;
+	};
+
+	std::unique_ptr<Slab> slabs[MAX_SLABS];
+	std::atomic<int> slabCount{0};
+	int maxSlabs = MAX_SLABS;
+	std::unique_ptr<Entry[]> table;
+	size_t tableMask = (1 << TABLE_BITS) - 1;
+	uint32_t generation = 0;
+};
 
 class MyAI {
 public:
@@ -17,7 +178,18 @@ public:
 	void Flip(int sq, FIN f);
 	void SetColor(COLOR c);
 	void SetTime(COLOR c, int t);
-	MOVE GenerateMove() const;
+	void SetThreads(int n);
+	void SetSeed(uint64_t seed);
+	void SetRave(int equivalence);
+	void SetNodeBudget(uint32_t nodes);
+	void SetPlayoutBatch(int leaves);
+	MOVE GenerateMove();
+
+	void searchWorker(uint64_t seed, bool mainThread);
+	MOVE bestRootMove(NodePool &pool, uint32_t node) const;
+	void startClock();
+	int elapsed() const;
+	void checkStop();
 
 	std::string GetProtocolVersion() const;
 	std::string GetAIName() const;
@@ -30,6 +202,29 @@ private:
 	FIN board[BOARD_SIZE];
 	int coverPieceCount[14];
 	int allCoverCount;
+
+	int threads = 1;
+	int maxIterations = 10000; // Iterations when no clock is given
+	int raveEquivalence = 1000;
+	int playoutBatch = PLAYOUT_LANES; // Leaves per batched playout, 1 for none
+	uint32_t nodeBudget = NodePool::MAX_SLABS * NodePool::SLAB_NODES; // Nodes in each pool
+	Random random; // Seeds the search threads
+	// The tree is kept between moves, root follows the moves played
+	NodePool pools[2]; // The live tree and the spare the next search copies into
+	int current = 0;
+	uint32_t root = NODE_NONE;
+	int treeColor = UNKNOWN; // Side the statistics of the tree are scored for
+
+	int startVisits; // Root visits carried over from the previous search
+	int searchStart; // ms on the clock when the iterations began, after the tree copy
+
+	std::chrono::steady_clock::time_point startTime;
+	int timeLimit; // ms, 0 when no clock is given
+	std::atomic<int> iterations;
+	std::atomic<bool> stop;
+
+	void advanceTree(MOVE move, FIN flip);
+	void recycleTree(uint32_t limit);
 };
 
 #endif
\ No newline at end of file
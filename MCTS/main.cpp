@@ -27,13 +27,34 @@ const char* commands_name[COMMAND_NUM] = {
     "init_board"
 };
 
-int main() {
+int main(int argc, char *argv[]) {
     std::string write;
 	char read[1024], *token;
     const char *data[100];
     int id, i;
     MyAI myai;
 
+    // Startup options: -threads <count>, -seed <number>, -rave <equivalence>,
+    // -nodes <count>, -batch <leaves>
+    for (i = 1; i + 1 < argc; i += 2) {
+        unsigned long long value;
+        if (sscanf(argv[i + 1], "%llu", &value) != 1) {
+            fprintf(stderr, "ignoring option %s: %s is not a number\n", argv[i], argv[i + 1]);
+            continue;
+        }
+        if (strcmp(argv[i], "-threads") == 0) {
+            myai.SetThreads((int)value);
+        } else if (strcmp(argv[i], "-seed") == 0) {
+            myai.SetSeed(value);
+        } else if (strcmp(argv[i], "-rave") == 0) {
+            myai.SetRave((int)value);
+        } else if (strcmp(argv[i], "-nodes") == 0) {
+            myai.SetNodeBudget((uint32_t)value);
+        } else if (strcmp(argv[i], "-batch") == 0) {
+            myai.SetPlayoutBatch((int)value);
+        }
+    }
+
     // Game Loop
     do {
         write.clear();
@@ -117,7 +138,7 @@ int main() {
             break;
         case 16: // time_left
         {
-            COLOR color = strcmp(data[0], "red") == 1 ? RED : BLK;
+            COLOR color = strcmp(data[0], "red") == 0 ? RED : BLK;
             int time;
             sscanf(data[1], "%d", &time);
             myai.SetTime(color, time);
@@ -0,0 +1,132 @@
+// Checks that MCTS iterations make no heap allocation once the node pool is
+// warm: select, expand, the scalar and the batched playouts, backpropagation,
+// AMAF and proof updates all work on the stack and in the pool's slabs.
+// The iteration functions are internal to MyAI.cpp, so it is built in.
+// Build from the repository root and run:
+//   g++ -std=c++17 -O2 -pthread MCTS/tests/alloc_test.cpp -o alloc_test && ./alloc_test
+#include <stdio.h>
+#include <stdlib.h>
+#include <new>
+
+#include "../MyAI.cpp"
+
+static long allocations = 0;
+
+void *operator new(size_t size) {
+    allocations++;
+    void *p = malloc(size ? size : 1);
+    if (p == nullptr) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void *operator new[](size_t size) {
+    return operator new(size);
+}
+
+void operator delete(void *p) noexcept {
+    free(p);
+}
+
+void operator delete[](void *p) noexcept {
+    free(p);
+}
+
+void operator delete(void *p, size_t) noexcept {
+    free(p);
+}
+
+void operator delete[](void *p, size_t) noexcept {
+    free(p);
+}
+
+static const int ITERATIONS = 20000;
+static const int RAVE_EQUIVALENCE = 1000;
+
+// One MCTS iteration from root, as MyAI::searchWorker runs it. Batched
+// playouts wait in pending until it holds PLAYOUT_LANES leaves
+static void iterate(NodePool &pool, NodePool::Cursor &cursor, uint32_t root, const PlayState &rootState,
+                    PendingLeaves &pending, Random &rng, bool batched) {
+    PlayState state = rootState;
+    uint32_t *path = pending.paths[pending.batch.count];
+    int length = select(pool, cursor, root, state, path, rng, RAVE_EQUIVALENCE, RED);
+    uint32_t leaf = pool.link(path[length - 1]);
+    NodePool::Slab &s = pool.slab(leaf);
+    int i = NodePool::offset(leaf);
+    int colors[MAX_PLY];
+    int8_t proof = s.proof[i].load();
+    if (proof == PROOF_NONE && s.state[i].load() == NODE_EXPANDED && s.childCount[i] == 0) {
+        proof = state.toMove == RED ? PROOF_LOSS : PROOF_WIN;
+        s.proof[i].store(proof);
+    }
+    if (proof != PROOF_NONE) {
+        backpropagate(pool, path, length, proof * WIN_SCORE);
+        pathColors(pool, path, length, RED, colors);
+        updateProofs(pool, path, length, colors, RED);
+    } else if (batched) {
+        pending.lengths[pending.batch.count] = length;
+        addPlayout(pending.batch, state);
+        if (pending.batch.count == PLAYOUT_LANES) {
+            playPending(pool, pending, RED, true, rng);
+        }
+        return;
+    } else {
+        MoveSet played[2] = {};
+        float score = simulate(state, RED, SIMULATION_DEPTH, rng, played);
+        backpropagate(pool, path, length, score);
+        pathColors(pool, path, length, RED, colors);
+        updateAmaf(pool, path, length, colors, played, score);
+    }
+    revertVirtualLoss(pool, path, length);
+}
+
+// Search ITERATIONS from state on a fresh graph in pool, the same iterations
+// for the same seed
+static void search(NodePool &pool, const PlayState &state, PendingLeaves &pending, bool batched) {
+    pool.reset();
+    NodePool::Cursor cursor;
+    uint32_t root = pool.allocate(cursor, 1);
+    pool.init(root, MOVE_NULL, FIN_EMPTY);
+    pool.insert(state.key, root);
+    Random rng(1);
+    for (int k = 0; k < ITERATIONS && pool.slab(root).proof[NodePool::offset(root)].load() == PROOF_NONE; k++) {
+        iterate(pool, cursor, root, state, pending, rng, batched);
+    }
+    playPending(pool, pending, RED, true, rng);
+}
+
+int main() {
+    // A midgame with covered pieces left, red to move
+    const char *squares = "XXK-R-XXgXXp-NG-c-XXC---PCgXXr--";
+    const int pieces[FIN_COVER] = {1, 1, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 5, 5};
+    FIN board[BOARD_SIZE];
+    int coverPieceCount[FIN_COVER];
+    memcpy(coverPieceCount, pieces, sizeof(coverPieceCount));
+    for (int sq = 0; sq < BOARD_SIZE; sq++) {
+        char c = squares[sq];
+        board[sq] = c == '-' ? FIN_EMPTY : c == 'X' ? FIN_COVER : char2fin(c);
+        if (board[sq] < FIN_COVER) {
+            coverPieceCount[board[sq]]--;
+        }
+    }
+    PlayState state = makeState(board, coverPieceCount, RED);
+
+    int failures = 0;
+    for (bool batched : {false, true}) {
+        NodePool pool;
+        std::unique_ptr<PendingLeaves> pending(new PendingLeaves);
+        search(pool, state, *pending, batched); // Warm up: the slabs and the table are allocated
+        allocations = 0;
+        search(pool, state, *pending, batched);
+        printf("%s playouts: %ld heap allocations in %d iterations\n", batched ? "batched" : "scalar",
+               allocations, ITERATIONS);
+        failures += allocations != 0;
+    }
+    if (failures > 0) {
+        printf("FAILED\n");
+        return 1;
+    }
+    printf("passed\n");
+    return 0;
+}
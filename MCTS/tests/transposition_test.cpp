@@ -0,0 +1,77 @@
+// Checks that the move chosen at the root honours a proof reached through a
+// transposition: the proof sits on the node keeping the position, the root
+// child only links to it.
+// Build from the repository root and run:
+//   g++ -std=c++17 -O2 -pthread MCTS/tests/transposition_test.cpp MCTS/MyAI.cpp -o transposition_test && ./transposition_test
+#include <stdio.h>
+
+#include "../libchess.h"
+#include "../MyAI.h"
+
+static int failures = 0;
+
+static void expect(MOVE got, MOVE want, const char *what) {
+    if (got != want) {
+        printf("FAILED %s: got %s, want %s\n", what, to_string(got).c_str(), to_string(want).c_str());
+        failures++;
+    }
+}
+
+// A root with two children, a1-a2 visited more than b1-b2, and one more node
+// elsewhere in the graph keeping the position proven with proof
+struct Graph {
+    NodePool pool;
+    NodePool::Cursor cursor;
+    uint32_t root, often, rarely, position;
+
+    explicit Graph(Proof proof) {
+        pool.reset();
+        root = pool.allocate(cursor, 1);
+        pool.init(root, MOVE_NULL, FIN_EMPTY);
+        often = pool.allocate(cursor, 2);
+        rarely = often + 1;
+        pool.init(often, make_move(string2square("a1"), string2square("a2")), FIN_EMPTY);
+        pool.init(rarely, make_move(string2square("b1"), string2square("b2")), FIN_EMPTY);
+        NodePool::Slab &s = pool.slab(root);
+        s.firstChild[NodePool::offset(root)] = often;
+        s.childCount[NodePool::offset(root)] = 2;
+        s.state[NodePool::offset(root)].store(NODE_EXPANDED);
+        pool.slab(often).visitCount[NodePool::offset(often)].store(100);
+        pool.slab(rarely).visitCount[NodePool::offset(rarely)].store(10);
+        position = pool.allocate(cursor, 1);
+        pool.init(position, MOVE_NULL, FIN_EMPTY);
+        pool.slab(position).proof[NodePool::offset(position)].store(proof);
+    }
+
+    // Make child reach the proven position by transposition
+    void transpose(uint32_t child) {
+        pool.slab(child).link[NodePool::offset(child)] = position;
+    }
+
+    MOVE move(uint32_t node) {
+        return (MOVE)pool.slab(node).move[NodePool::offset(node)];
+    }
+};
+
+int main() {
+    MyAI ai;
+    {
+        Graph g(PROOF_WIN);
+        expect(ai.bestRootMove(g.pool, g.root), g.move(g.often), "no transposition");
+    }
+    {
+        Graph g(PROOF_WIN);
+        g.transpose(g.rarely);
+        expect(ai.bestRootMove(g.pool, g.root), g.move(g.rarely), "transposed proven win");
+    }
+    {
+        Graph g(PROOF_LOSS);
+        g.transpose(g.often);
+        expect(ai.bestRootMove(g.pool, g.root), g.move(g.rarely), "transposed proven loss");
+    }
+    if (failures > 0) {
+        return 1;
+    }
+    printf("passed\n");
+    return 0;
+}